@@ -0,0 +1,238 @@
+//common.glsl
+
+// Put in every shader after its #version line and defines, see
+// setShaderCommon() in shaders.c and initShaderCommon() in sinewave3D-glm.cpp,
+// which defines NUM_VIEWS, SPECTRUM_MAX_WAVES, the sines' A1, k1, w1, A2, k2
+// and w2, and the LOD_* errors of selectLodChunks() for tess.tesc
+
+// Shared by every program, see setShadingState() in sinewave3D-glm.cpp
+layout(std140) uniform ShadingState {
+  mat4 uModelViewMat, uProjectionMat;
+  mat3 uNormalMat;
+  float uShininess, uTime;
+  int uTesselation;        // mesh made from gl_VertexID when > 0, patches a side with tess.tesc
+  bool uFlat;
+  mat4 uViewMat[NUM_VIEWS];  // per view, single pass multiview only
+  mat3 uViewNormalMat[NUM_VIEWS];
+  float uHeightmapSpan;    // texels of uHeightmap from -1 to 1, see heightmapSpan()
+#ifndef PERMUTATION
+  int uDimension;
+  bool uPhong, uPixel, uPositional, uFixed, uLighting;
+#endif
+};
+#ifdef PERMUTATION
+// Compiled for one combination of the flags, see shaderVariant()
+const int uDimension = DIMENSION;
+const bool uPhong = PHONG, uPixel = PIXEL, uPositional = POSITIONAL, uFixed = FIXED, uLighting = LIGHTING;
+#endif
+
+// Gerstner waves of uDimension 4, see updateSpectrumBlock() in
+// sinewave3D-glm.cpp: per wave its direction, wavenumber and amplitude, then
+// its speed, phase and steepness
+layout(std140) uniform WaveSpectrum {
+  vec4 uWaves[2 * SPECTRUM_MAX_WAVES];
+  vec4 uWaveBounds;        // amplitude, reach, curvature and its rate of change
+  int uWaveCount;
+};
+
+// Maps of the height and its slopes along x and z over the [-1,1] square for
+// uDimension 5: the FFT ocean's, repeating, or those of the wave baked by
+// bakeHeightmap(), see bindHeightmap() in sinewave3D-glm.cpp
+uniform sampler2D uHeightmap;
+
+// Quadtree LOD chunks of the draw, an instance each (see drawLodChunks()):
+// x and z of the corner, the size and how far it is morphed to its parent's
+// grid. uLod is set while drawing them
+layout(std140) uniform LodChunks {
+  vec4 uChunks[LOD_BATCH];
+};
+uniform bool uLod;
+
+// Point id of a uTesselation grid, row by row
+vec4 gridPoint(int id)
+{
+  int row = id / (uTesselation + 1), column = id % (uTesselation + 1);
+  float stepSize = 2.0 / float(uTesselation);
+
+  return vec4(-1.0 + float(column) * stepSize, 0.0, -1.0 + float(row) * stepSize, 1.0);
+}
+
+// Grid point of vertex id when the mesh is drawn without vertex arrays
+// (uTesselation > 0, see drawVBOShape()), counting the vertices of the two
+// triangles of each quad in the order of the index buffer
+vec4 gridVertex(int id)
+{
+  int quad = id / 6, corner = id % 6;
+  int row = quad / uTesselation + ((0x32 >> corner) & 1);
+  int column = quad % uTesselation + ((0x2C >> corner) & 1);
+  float stepSize = 2.0 / float(uTesselation);
+
+  return vec4(-1.0 + float(column) * stepSize, 0.0, -1.0 + float(row) * stepSize, 1.0);
+}
+
+// Grid point of vertex id in LOD chunk instance, indexing a uTesselation grid row
+// by row. Odd grid lines slide onto the even ones as the chunk morphs to its
+// parent, whose grid has half the resolution
+vec4 chunkVertex(int id, int instance)
+{
+  vec4 chunk = uChunks[instance];
+  vec2 grid = vec2(id % (uTesselation + 1), id / (uTesselation + 1));
+
+  grid -= mod(grid, 2.0) * chunk.w;
+  vec2 xz = chunk.xy + grid * (chunk.z / float(uTesselation));
+  return vec4(xz.x, 0.0, xz.y, 1.0);
+}
+
+// Height of the sines of a dimension (2 or 3) at xz and time t, and their
+// slopes along x and z
+vec3 sineWaves(vec2 xz, float t, int dimension)
+{
+  vec3 h = vec3(A1 * sin(k1 * xz.x + w1 * t), A1 * k1 * cos(k1 * xz.x + w1 * t), 0.0);
+
+  if (dimension == 3) {
+    h.x += A2 * sin(k2 * xz.y + w2 * t);
+    h.z = A2 * k2 * cos(k2 * xz.y + w2 * t);
+  }
+  return h;
+}
+
+// Sums of the spectrum at grid point p and time t, as evaluateSpectrumSoA() in
+// spectrum.c: its displacement d and the derivatives S and C of the normal.
+// Each wave's speed t + phase is reduced to [0, 2 pi) as wavePhase() does, so
+// the sines stay as accurate however long the wave has run
+void spectrumSums(vec2 p, float t, out vec3 d, out vec3 S, out vec2 C)
+{
+  const float twoPi = 6.28318530717959;
+
+  d = vec3(0.0);
+  S = vec3(0.0);
+  C = vec2(0.0);
+
+  for (int i = 0; i < uWaveCount; i++) {
+    vec4 a = uWaves[2 * i], b = uWaves[2 * i + 1];
+    float theta = a.z * dot(a.xy, p) + mod(b.x * t + b.y, twoPi);
+    float s = sin(theta), c = cos(theta);
+    float qa = b.z * a.w;
+
+    d += vec3(qa * a.x * c, a.w * s, qa * a.y * c);
+    S += (qa * a.z * s) * vec3(a.x * a.x, a.x * a.y, a.y * a.y);
+    C += (a.w * a.z * c) * a.xy;
+  }
+}
+
+// Normal of the spectrum from the sums S and C of spectrumSums()
+vec3 spectrumNormal(vec3 S, vec2 C)
+{
+  return vec3(-S.y * C.y - (1.0 - S.z) * C.x, (1.0 - S.x) * (1.0 - S.z) - S.y * S.y,
+    -S.y * C.x - (1.0 - S.x) * C.y);
+}
+
+// Grid point v moved by the waves of the spectrum, and its normal n
+vec4 spectrumVertex(vec4 v, out vec3 n)
+{
+  vec3 d, S;
+  vec2 C;
+
+  spectrumSums(v.xz, uTime, d, S, C);
+  n = spectrumNormal(S, C);
+  return vec4(v.x + d.x, d.y, v.z + d.z, 1.0);
+}
+
+// Texture coordinate of grid point xz in the maps. Texel i is at
+// -1 + 2 i / uHeightmapSpan, past the ocean's last texel its wrap repeats them
+vec2 heightmapCoord(vec2 xz)
+{
+  vec2 size = vec2(textureSize(uHeightmap, 0));
+  return ((xz + 1.0) * 0.5 * uHeightmapSpan + 0.5) / size;
+}
+
+// Grid point v raised to the height of the maps and its normal n from their
+// slopes, as sampleOcean() in ocean.c
+vec4 heightmapVertex(vec4 v, out vec3 n)
+{
+  vec3 h = textureLod(uHeightmap, heightmapCoord(v.xz), 0.0).xyz;
+
+  n = vec3(-h.y, 1.0, -h.z);
+  return vec4(v.x, h.x, v.z, 1.0);
+}
+
+// Normal of the maps at grid point xz, for per pixel lighting
+vec3 heightmapNormal(vec2 xz)
+{
+  vec3 h = texture(uHeightmap, heightmapCoord(xz)).xyz;
+
+  return vec3(-h.y, 1.0, -h.z);
+}
+
+// Color of the light at eye coordinates rEC with the normal nEC, Phong or
+// Blinn-Phong, as computeLightingSoA() in lighting.c: per vertex (uFixed) or
+// per pixel (uPixel)
+vec3 computeLighting(vec3 rEC, vec3 nEC)
+{
+  vec3 color = vec3(0.0); //final return color to be used
+
+  vec3 La = vec3(0.2); //ambient intensity
+  vec3 Ma = vec3(0.2); //ambient reflection coefficient
+  vec3 ambient = (La * Ma); //calculate ambient
+  color += ambient; //add ambient to final color
+
+  vec3 lEC = vec3 ( 0.5, 0.5, 0.5 ); //light position
+  if (uPositional)
+    lEC = lEC - rEC;
+
+  float dp = dot(nEC, lEC); //dot product between light & scene normals (lambertion)
+  if (dp > 0.0) {
+    vec3 Ld = vec3(0.0, 0.5, 0.5); //intensity of the (point) light source
+    vec3 Md = vec3(0.8); //diffuse reflection coefficient
+
+    nEC = normalize(nEC); //normalize scene normals
+    float NdotL = dot(nEC, lEC); //dot product between normalized scene normals & light
+    vec3 diffuse = (Ld * Md * NdotL); //calculate diffuse
+    color += diffuse; //add diffuse to final color
+
+    vec3 Ls = vec3(0.8); //intensity of the (point) light source
+    vec3 Ms = vec3(1.0); //specular reflection coefficient
+
+    vec3 vEC = vec3(0.0, 0.0, 1.0); //viewer direction
+    if (uPositional)
+      vEC = vEC - rEC;
+
+    if (uPhong) { //Phong lighting
+      vec3 R = reflect(lEC, nEC);
+      R = normalize(-R);
+      float VdotR = dot(vEC, R);
+      if (VdotR < 0.0)
+        VdotR = 0.0;
+      vec3 specular = (Ls * Ms * pow(VdotR, uShininess)); //calculate specular
+      color += specular; //add specular to final color
+    }
+    else { //Blinn-Phong lighting
+      vec3 H = (lEC + vEC);
+      H = normalize(H);
+      float NdotH = dot(nEC, H);
+      if (NdotH < 0.0)
+        NdotH = 0.0;
+      vec3 specular = (Ls * Ms * pow(NdotH, uShininess)); //calculate specular
+      color += specular; //add specular to final color
+    }
+  }
+
+  return color;
+}
+
+// Grid point v on the wave of uDimension, and its normal n (unnormalized, up
+// for the flat grid)
+vec4 waveVertex(vec4 v, out vec3 n)
+{
+  n = vec3(0.0, 1.0, 0.0);
+  if (uDimension == 2 || uDimension == 3) {
+    vec3 h = sineWaves(v.xz, uTime, uDimension);
+    v.y = h.x;
+    n = vec3(-h.y, 1.0, -h.z);
+  } else if (uDimension == 4) {
+    v = spectrumVertex(v, n);
+  } else if (uDimension == 5) {
+    v = heightmapVertex(v, n);
+  }
+  return v;
+}
@@ -0,0 +1,107 @@
+/* File change notification, see filewatch.h */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#if __linux__
+#	include <sys/inotify.h>
+#	include <unistd.h>
+#endif
+
+#include "filewatch.h"
+
+static struct {
+  int initialized;
+  int count;
+  char names[WATCH_FILES][256];
+  const char* base[WATCH_FILES];   /* file name without its directory */
+  int dir[WATCH_FILES];            /* inotify watch of its directory */
+  time_t mtime[WATCH_FILES];       /* for polling, 0 if missing */
+  int fd;                          /* inotify, -1 when polling */
+} watch;
+
+static time_t modifiedTime(const char* filename)
+{
+  struct stat st;
+  return stat(filename, &st) == 0 ? st.st_mtime : 0;
+}
+
+int watchFile(const char* filename)
+{
+  int i = watch.count;
+
+  if (!watch.initialized) {
+    watch.fd = -1;
+#if __linux__
+    watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    watch.initialized = 1;
+  }
+  if (i == WATCH_FILES)
+    return 0;
+  snprintf(watch.names[i], sizeof watch.names[i], "%s", filename);
+  watch.base[i] = strrchr(watch.names[i], '/');
+  watch.base[i] = watch.base[i] ? watch.base[i] + 1 : watch.names[i];
+  watch.mtime[i] = modifiedTime(filename);
+
+#if __linux__
+  if (watch.fd >= 0) {
+    char dir[256];
+    int length = (int) (watch.base[i] - watch.names[i]);
+    snprintf(dir, sizeof dir, "%.*s", length, watch.names[i]);
+    /* watching a directory twice returns its existing watch */
+    watch.dir[i] = inotify_add_watch(watch.fd, length ? dir : ".", IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (watch.dir[i] < 0)
+      return 0;
+  }
+#endif
+  watch.count++;
+  return 1;
+}
+
+#if __linux__
+static int inotifyChanged(void)
+{
+  /* aligned for the events read into it */
+  char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event* e;
+  char* p;
+  int changed = 0, i;
+  ssize_t length;
+
+  while ((length = read(watch.fd, buffer, sizeof buffer)) > 0) {
+    for (p = buffer; p < buffer + length; p += sizeof *e + e->len) {
+      e = (const struct inotify_event*) p;
+      if (!e->len)
+        continue;
+      for (i = 0; i < watch.count; i++)
+        if (watch.dir[i] == e->wd && strcmp(watch.base[i], e->name) == 0)
+          changed = 1;
+    }
+  }
+  return changed;
+}
+#endif
+
+int filesChanged(void)
+{
+  int changed = 0, i;
+
+#if __linux__
+  if (watch.fd >= 0)
+    return inotifyChanged();
+#endif
+  for (i = 0; i < watch.count; i++) {
+    time_t mtime = modifiedTime(watch.names[i]);
+    if (mtime != watch.mtime[i]) {
+      watch.mtime[i] = mtime;
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+const char* watchMethod(void)
+{
+  return watch.initialized && watch.fd >= 0 ? "inotify" : "polling";
+}
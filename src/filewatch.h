@@ -0,0 +1,31 @@
+/*
+Change notification for a few files, such as shaders being edited.
+
+use watchFile() to add a file, its directory is watched so files that editors
+replace (written to another name and renamed) are still seen
+use filesChanged() to find out, without blocking, whether any watched file
+has been written since the last call
+Linux uses inotify, other systems compare modification times on each call
+*/
+
+#ifndef FILEWATCH_H
+#define FILEWATCH_H
+
+#if __cplusplus
+extern "C" {
+#endif
+
+
+#define WATCH_FILES 32
+
+int watchFile(const char* filename);
+int filesChanged(void);
+const char* watchMethod(void);
+
+
+#if __cplusplus
+}
+#endif
+
+
+#endif
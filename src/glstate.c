@@ -0,0 +1,417 @@
+/* GL state cache, see glstate.h */
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <assert.h>
+#include <string.h>
+
+#include "glstate.h"
+
+#define UNIFORM_BINDINGS 4
+#define TEXTURE_UNITS 4
+
+typedef enum { c_lighting, c_light0, c_normalize, c_depthTest, c_primitiveRestart, c_ncaps } Caps;
+typedef enum { m_ambient, m_diffuse, m_specular, m_emission, m_shininess, m_nmaterials } Materials;
+typedef enum { b_array, b_elementArray, b_uniform, b_ntargets } Targets;
+
+/* Everything is unknown (known = 0) until first set */
+typedef struct {
+  int known;
+  GLuint buffer;
+  GLintptr offset;
+  GLsizeiptr size;
+} BufferRange;
+
+static struct {
+  int caps[c_ncaps];                  /* -1 unknown, else enabled */
+  GLenum shadeModel, polygonMode;     /* 0 unknown */
+  int twoSide;                        /* -1 unknown */
+  int materialKnown[m_nmaterials];
+  GLfloat material[m_nmaterials][4];  /* of GL_FRONT */
+  int programKnown;
+  GLuint program;
+  int bufferKnown[b_ntargets];
+  GLuint buffers[b_ntargets];
+  BufferRange ranges[UNIFORM_BINDINGS];
+  int arrayKnown;
+  GLuint array;
+  int viewportKnown;
+  GLint viewport[4];
+  GLenum activeTexture;               /* 0 unknown */
+  int textureKnown[TEXTURE_UNITS];
+  GLuint textures[TEXTURE_UNITS];     /* GL_TEXTURE_2D of each unit */
+  int drawFramebufferKnown, readFramebufferKnown;
+  GLuint drawFramebuffer, readFramebuffer;
+
+  int issued, elided;                 /* calls so far this frame */
+  int lastIssued, lastElided;         /* those of the last frame */
+} state;
+
+/* Counts the call, true if it has to be issued */
+static int changed(int same)
+{
+  if (same) {
+    state.elided++;
+    return 0;
+  }
+  state.issued++;
+  return 1;
+}
+
+void stateReset(void)
+{
+  int i;
+
+  memset(&state, 0, sizeof state);
+  for (i = 0; i < c_ncaps; i++)
+    state.caps[i] = -1;
+  state.twoSide = -1;
+  /* a new context draws to and reads from its default framebuffer */
+  state.drawFramebufferKnown = state.readFramebufferKnown = 1;
+}
+
+static int capIndex(GLenum cap)
+{
+  switch (cap) {
+    case GL_LIGHTING: return c_lighting;
+    case GL_LIGHT0: return c_light0;
+    case GL_NORMALIZE: return c_normalize;
+    case GL_DEPTH_TEST: return c_depthTest;
+    case GL_PRIMITIVE_RESTART: return c_primitiveRestart;
+  }
+  return -1;
+}
+
+static void setCap(GLenum cap, int enable)
+{
+  int i = capIndex(cap);
+
+  if (i >= 0 && !changed(state.caps[i] == enable))
+    return;
+  if (i < 0)
+    state.issued++;
+  else
+    state.caps[i] = enable;
+  if (enable)
+    glEnable(cap);
+  else
+    glDisable(cap);
+}
+
+void stateEnable(unsigned int cap)
+{
+  setCap(cap, 1);
+}
+
+void stateDisable(unsigned int cap)
+{
+  setCap(cap, 0);
+}
+
+void stateShadeModel(unsigned int mode)
+{
+  if (!changed(state.shadeModel == mode))
+    return;
+  state.shadeModel = mode;
+  glShadeModel(mode);
+}
+
+void statePolygonMode(unsigned int face, unsigned int mode)
+{
+  /* only both faces set together is tracked */
+  if (face != GL_FRONT_AND_BACK) {
+    state.polygonMode = 0;
+    state.issued++;
+  }
+  else if (!changed(state.polygonMode == mode))
+    return;
+  else
+    state.polygonMode = mode;
+  glPolygonMode(face, mode);
+}
+
+void stateLightModeli(unsigned int pname, int param)
+{
+  if (pname != GL_LIGHT_MODEL_TWO_SIDE)
+    state.issued++;
+  else if (!changed(state.twoSide == (param != 0)))
+    return;
+  else
+    state.twoSide = param != 0;
+  glLightModeli(pname, param);
+}
+
+static int materialIndex(GLenum pname)
+{
+  switch (pname) {
+    case GL_AMBIENT: return m_ambient;
+    case GL_DIFFUSE: return m_diffuse;
+    case GL_SPECULAR: return m_specular;
+    case GL_EMISSION: return m_emission;
+    case GL_SHININESS: return m_shininess;
+  }
+  return -1;
+}
+
+void stateMaterialfv(unsigned int face, unsigned int pname, const float* params)
+{
+  int i = materialIndex(pname);
+  size_t size = (pname == GL_SHININESS ? 1 : 4) * sizeof(GLfloat);
+
+  if (face == GL_FRONT && i >= 0) {
+    if (!changed(state.materialKnown[i] && memcmp(state.material[i], params, size) == 0))
+      return;
+    memcpy(state.material[i], params, size);
+    state.materialKnown[i] = 1;
+  }
+  else {
+    /* untracked, but may change what is known of GL_FRONT */
+    state.issued++;
+    if (face != GL_BACK) {
+      if (i >= 0)
+        state.materialKnown[i] = 0;
+      if (pname == GL_AMBIENT_AND_DIFFUSE)
+        state.materialKnown[m_ambient] = state.materialKnown[m_diffuse] = 0;
+    }
+  }
+  glMaterialfv(face, pname, params);
+}
+
+void stateMaterialf(unsigned int face, unsigned int pname, float param)
+{
+  stateMaterialfv(face, pname, &param);
+}
+
+void stateUseProgram(unsigned int program)
+{
+  if (!changed(state.programKnown && state.program == program))
+    return;
+  state.program = program;
+  state.programKnown = 1;
+  glUseProgram(program);
+}
+
+static int targetIndex(GLenum target)
+{
+  switch (target) {
+    case GL_ARRAY_BUFFER: return b_array;
+    case GL_ELEMENT_ARRAY_BUFFER: return b_elementArray;
+    case GL_UNIFORM_BUFFER: return b_uniform;
+  }
+  return -1;
+}
+
+void stateBindBuffer(unsigned int target, unsigned int buffer)
+{
+  int i = targetIndex(target);
+
+  if (i >= 0 && !changed(state.bufferKnown[i] && state.buffers[i] == buffer))
+    return;
+  if (i < 0)
+    state.issued++;
+  else {
+    state.buffers[i] = buffer;
+    state.bufferKnown[i] = 1;
+  }
+  glBindBuffer(target, buffer);
+}
+
+void stateBindBufferRange(unsigned int target, unsigned int index, unsigned int buffer,
+  ptrdiff_t offset, ptrdiff_t size)
+{
+  int i = targetIndex(target);
+
+  if (target != GL_UNIFORM_BUFFER || index >= UNIFORM_BINDINGS)
+    state.issued++;
+  else {
+    BufferRange* r = &state.ranges[index];
+    if (!changed(r->known && r->buffer == buffer && r->offset == offset && r->size == size))
+      return;
+    r->known = 1;
+    r->buffer = buffer;
+    r->offset = offset;
+    r->size = size;
+  }
+  glBindBufferRange(target, index, buffer, offset, size);
+
+  /* the generic binding is set as well */
+  if (i >= 0) {
+    state.buffers[i] = buffer;
+    state.bufferKnown[i] = 1;
+  }
+}
+
+void stateBindVertexArray(unsigned int array)
+{
+  if (!changed(state.arrayKnown && state.array == array))
+    return;
+  state.array = array;
+  state.arrayKnown = 1;
+  /* the element array buffer is the vertex array's */
+  state.bufferKnown[b_elementArray] = 0;
+  glBindVertexArray(array);
+}
+
+void stateDeleteBuffers(int n, const unsigned int* buffers)
+{
+  int i, j;
+
+  /* deleted buffers are unbound from wherever they were bound */
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < b_ntargets; j++)
+      if (state.buffers[j] == buffers[i])
+        state.buffers[j] = 0;
+    for (j = 0; j < UNIFORM_BINDINGS; j++)
+      if (state.ranges[j].buffer == buffers[i])
+        state.ranges[j].known = 0;
+  }
+  glDeleteBuffers(n, buffers);
+}
+
+void stateDeleteVertexArrays(int n, const unsigned int* arrays)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    if (state.array == arrays[i]) {
+      state.array = 0;
+      state.bufferKnown[b_elementArray] = 0;
+    }
+  glDeleteVertexArrays(n, arrays);
+}
+
+void stateActiveTexture(unsigned int texture)
+{
+  if (!changed(state.activeTexture == texture))
+    return;
+  state.activeTexture = texture;
+  glActiveTexture(texture);
+}
+
+void stateBindTexture(unsigned int target, unsigned int texture)
+{
+  unsigned int unit = state.activeTexture - GL_TEXTURE0;
+
+  /* only GL_TEXTURE_2D of the first units, once the active one is known */
+  if (target != GL_TEXTURE_2D || !state.activeTexture || unit >= TEXTURE_UNITS)
+    state.issued++;
+  else {
+    if (!changed(state.textureKnown[unit] && state.textures[unit] == texture))
+      return;
+    state.textures[unit] = texture;
+    state.textureKnown[unit] = 1;
+  }
+  glBindTexture(target, texture);
+}
+
+void stateBindTextureUnit(unsigned int unit, unsigned int texture)
+{
+  GLenum active = state.activeTexture ? state.activeTexture : GL_TEXTURE0;
+
+  if (unit < TEXTURE_UNITS && state.textureKnown[unit] && state.textures[unit] == texture) {
+    state.elided++;
+    return;
+  }
+  stateActiveTexture(GL_TEXTURE0 + unit);
+  stateBindTexture(GL_TEXTURE_2D, texture);
+  stateActiveTexture(active);
+}
+
+void stateDeleteTextures(int n, const unsigned int* textures)
+{
+  int i, j;
+
+  /* deleted textures are unbound from the units they were bound to */
+  for (i = 0; i < n; i++)
+    for (j = 0; j < TEXTURE_UNITS; j++)
+      if (state.textures[j] == textures[i])
+        state.textures[j] = 0;
+  glDeleteTextures(n, textures);
+}
+
+void stateBindFramebuffer(unsigned int target, unsigned int framebuffer)
+{
+  int draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+  int read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+
+  if (!changed((!draw || (state.drawFramebufferKnown && state.drawFramebuffer == framebuffer)) &&
+      (!read || (state.readFramebufferKnown && state.readFramebuffer == framebuffer))))
+    return;
+  if (draw) {
+    state.drawFramebuffer = framebuffer;
+    state.drawFramebufferKnown = 1;
+  }
+  if (read) {
+    state.readFramebuffer = framebuffer;
+    state.readFramebufferKnown = 1;
+  }
+  glBindFramebuffer(target, framebuffer);
+}
+
+unsigned int stateGetDrawFramebuffer(void)
+{
+  assert(state.drawFramebufferKnown);
+  return state.drawFramebuffer;
+}
+
+void stateDeleteFramebuffers(int n, const unsigned int* framebuffers)
+{
+  int i;
+
+  /* deleting a bound framebuffer binds 0 in its place */
+  for (i = 0; i < n; i++) {
+    if (state.drawFramebuffer == framebuffers[i])
+      state.drawFramebuffer = 0;
+    if (state.readFramebuffer == framebuffers[i])
+      state.readFramebuffer = 0;
+  }
+  glDeleteFramebuffers(n, framebuffers);
+}
+
+void stateViewport(int x, int y, int width, int height)
+{
+  GLint viewport[4] = { x, y, width, height };
+
+  if (!changed(state.viewportKnown && memcmp(state.viewport, viewport, sizeof viewport) == 0))
+    return;
+  memcpy(state.viewport, viewport, sizeof viewport);
+  state.viewportKnown = 1;
+  glViewport(x, y, width, height);
+}
+
+void stateViewportIndexedf(unsigned int index, float x, float y, float width, float height)
+{
+  /* always issued, viewport 0 is the one glViewport() sets and is read */
+  state.issued++;
+  if (index == 0) {
+    state.viewport[0] = (GLint) x;
+    state.viewport[1] = (GLint) y;
+    state.viewport[2] = (GLint) width;
+    state.viewport[3] = (GLint) height;
+    state.viewportKnown = 1;
+  }
+  glViewportIndexedf(index, x, y, width, height);
+}
+
+void stateGetViewport(int* viewport)
+{
+  /* set by stateViewport() first, never read back from GL */
+  assert(state.viewportKnown);
+  memcpy(viewport, state.viewport, sizeof state.viewport);
+}
+
+void stateFrame(void)
+{
+  state.lastIssued = state.issued;
+  state.lastElided = state.elided;
+  state.issued = state.elided = 0;
+}
+
+void stateCounts(int* issued, int* elided)
+{
+  *issued = state.lastIssued;
+  *elided = state.lastElided;
+}
@@ -0,0 +1,65 @@
+/*
+Software copy of the GL state that is set on every draw, so calls that
+wouldn't change anything are dropped before reaching the driver, and the
+state is never read back from it (no glGet*() sync points).
+
+use stateReset() once a GL context exists, before anything else sets its
+state (or to forget the state): the framebuffers start as the default one,
+every other value unknown until set by its first call
+use the state*() functions in place of the gl*() ones of the same name for
+everything they cover, state changed by other means (glPopAttrib() aside,
+which restores what was there) leaves the copy out of date
+use stateGetViewport() for the viewport and stateGetDrawFramebuffer() for the
+draw framebuffer instead of glGetIntegerv(), the viewport once stateViewport()
+has set it
+use stateBindTextureUnit() to bind a 2D texture to a unit and keep the active
+unit (GL_TEXTURE0 if it wasn't known), as glBindTextureUnit() does
+use stateFrame() after each frame, stateCounts() then gives the calls that
+frame issued to the driver and elided
+*/
+
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <stddef.h>
+
+#if __cplusplus
+extern "C" {
+#endif
+
+
+void stateReset(void);
+void stateEnable(unsigned int cap);
+void stateDisable(unsigned int cap);
+void stateShadeModel(unsigned int mode);
+void statePolygonMode(unsigned int face, unsigned int mode);
+void stateLightModeli(unsigned int pname, int param);
+void stateMaterialfv(unsigned int face, unsigned int pname, const float* params);
+void stateMaterialf(unsigned int face, unsigned int pname, float param);
+void stateUseProgram(unsigned int program);
+void stateBindBuffer(unsigned int target, unsigned int buffer);
+void stateBindBufferRange(unsigned int target, unsigned int index, unsigned int buffer,
+  ptrdiff_t offset, ptrdiff_t size);
+void stateBindVertexArray(unsigned int array);
+void stateDeleteBuffers(int n, const unsigned int* buffers);
+void stateDeleteVertexArrays(int n, const unsigned int* arrays);
+void stateActiveTexture(unsigned int texture);
+void stateBindTexture(unsigned int target, unsigned int texture);
+void stateBindTextureUnit(unsigned int unit, unsigned int texture);
+void stateDeleteTextures(int n, const unsigned int* textures);
+void stateBindFramebuffer(unsigned int target, unsigned int framebuffer);
+unsigned int stateGetDrawFramebuffer(void);
+void stateDeleteFramebuffers(int n, const unsigned int* framebuffers);
+void stateViewport(int x, int y, int width, int height);
+void stateViewportIndexedf(unsigned int index, float x, float y, float width, float height);
+void stateGetViewport(int* viewport);
+void stateFrame(void);
+void stateCounts(int* issued, int* elided);
+
+
+#if __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,38 @@
+//heightmap.frag
+#version 150
+
+// The wave baked and its time, set by bakeHeightmap() in sinewave3D-glm.cpp.
+// Not those of ShadingState: the programs reading the heightmap have uDimension 5
+uniform int uBakeDimension;
+uniform float uBakeTime;
+uniform int uBakeSize;     // texels a side
+
+// Height and slopes along x and z, as heightmapVertex() in common.glsl reads them
+out vec4 fragColor;
+
+void main(void)
+{
+  // Texel i is at -1 + 2 i / (size - 1), the last at 1
+  vec2 xz = -1.0 + 2.0 * (gl_FragCoord.xy - 0.5) / float(uBakeSize - 1);
+  vec3 h = vec3(0.0);
+
+  if (uBakeDimension == 2 || uBakeDimension == 3)
+    h = sineWaves(xz, uBakeTime, uBakeDimension);
+  if (uBakeDimension == 4) {
+    // The spectrum moves grid points sideways, the surface above xz is that of
+    // the grid point p moved onto it, found by Newton's method from xz (the
+    // waves never fold, their steepness is under 1, see spectrum.c)
+    vec3 d, S;
+    vec2 C, p = xz;
+    for (int i = 0; i < 2; i++) {
+      spectrumSums(p, uBakeTime, d, S, C);
+      p -= inverse(mat2(1.0 - S.x, -S.y, -S.y, 1.0 - S.z)) * (p + d.xz - xz);
+    }
+    spectrumSums(p, uBakeTime, d, S, C);
+
+    vec3 n = spectrumNormal(S, C);
+    h = vec3(d.y, -n.x / n.y, -n.z / n.y);
+  }
+
+  fragColor = vec4(h, 1.0);
+}
@@ -0,0 +1,10 @@
+//heightmap.vert
+#version 150
+
+// A triangle covering the heightmap's framebuffer, see bakeHeightmap() in
+// sinewave3D-glm.cpp, made from gl_VertexID without vertex arrays
+void main(void)
+{
+  vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - 1.0;
+  gl_Position = vec4(corner, 0.0, 1.0);
+}
@@ -0,0 +1,344 @@
+/* Batch CPU lighting, scalar reference plus SSE/AVX2 kernels */
+
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#	define LIGHTING_X86 1
+#	include <immintrin.h>
+#endif
+
+#include "lighting.h"
+
+typedef void (*LightingKernel)(const LightingParams* params, int n,
+  const float* px, const float* py, const float* pz,
+  const float* nx, const float* ny, const float* nz,
+  float* r, float* g, float* b);
+
+/* Light and material terms, same values as shader.vert/shader.frag:
+ * ambient La*Ma = 0.2*0.2, diffuse Ld*Md = (0, 0.5, 0.5)*0.8,
+ * specular Ls*Ms = 0.8*1.0 and the light at (0.5, 0.5, 0.5) */
+#define AMBIENT 0.04f
+#define DIFFUSE 0.4f
+#define SPECULAR 0.8f
+#define LIGHT 0.5f
+
+/* Perform ADS - ambient, diffuse and specular - lighting calculation
+ * in eye coordinates (EC), one vertex at a time.
+ */
+static void lightScalar(const LightingParams* params, int n,
+  const float* px, const float* py, const float* pz,
+  const float* nx, const float* ny, const float* nz,
+  float* r, float* g, float* b)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    /* Ambient contribution: A=La×Ma */
+    float spec = 0.0f, diffuse = 0.0f;
+
+    /* Light vector, directional unless positional is set in which case it
+     * is relative to the vertex (not normalized, as in the shaders) */
+    float lx = LIGHT, ly = LIGHT, lz = LIGHT;
+    if (params->positional) {
+      lx -= px[i];
+      ly -= py[i];
+      lz -= pz[i];
+    }
+
+    /* Test if normal points towards light source, i.e. if polygon
+     * faces toward the light - if not then no diffuse or specular
+     * contribution */
+    float dp = nx[i] * lx + ny[i] * ly + nz[i] * lz;
+    if (dp > 0.0f) {
+      /* Lambert diffuse: D=Ld×Md×cosθ, needs the normalized normal */
+      float len = sqrtf(nx[i] * nx[i] + ny[i] * ny[i] + nz[i] * nz[i]);
+      float ux = nx[i] / len, uy = ny[i] / len, uz = nz[i] / len;
+      float NdotL = ux * lx + uy * ly + uz * lz;
+      diffuse = DIFFUSE * NdotL;
+
+      /* Default viewer is at infinity along z axis <0, 0, 1> i.e. a
+       * non local viewer, or relative to the vertex when positional */
+      float vx = 0.0f, vy = 0.0f, vz = 1.0f;
+      if (params->positional) {
+        vx -= px[i];
+        vy -= py[i];
+        vz -= pz[i];
+      }
+
+      float cosAlpha;
+      if (params->phong) {
+        /* Phong specular: S=Ls×Ms×cosⁿα, α between viewer and the
+         * normalized reflection of the light vector */
+        float Rx = 2.0f * NdotL * ux - lx;
+        float Ry = 2.0f * NdotL * uy - ly;
+        float Rz = 2.0f * NdotL * uz - lz;
+        float Rlen = sqrtf(Rx * Rx + Ry * Ry + Rz * Rz);
+        cosAlpha = (vx * Rx + vy * Ry + vz * Rz) / Rlen;
+      }
+      else {
+        /* Blinn-Phong specular: S=Ls×Ms×cosⁿα, α between the normal
+         * and the normalized half vector H */
+        float Hx = lx + vx, Hy = ly + vy, Hz = lz + vz;
+        float Hlen = sqrtf(Hx * Hx + Hy * Hy + Hz * Hz);
+        cosAlpha = (ux * Hx + uy * Hy + uz * Hz) / Hlen;
+      }
+      if (cosAlpha < 0.0f)
+        cosAlpha = 0.0f;
+      spec = SPECULAR * powf(cosAlpha, params->shininess);
+    }
+
+    r[i] = AMBIENT + spec;
+    g[i] = AMBIENT + diffuse + spec;
+    b[i] = AMBIENT + diffuse + spec;
+  }
+}
+
+#ifdef LIGHTING_X86
+/* pow(x, y) for x in [0, 1] as exp2(y * log2(x)), using the Cephes
+ * logf/exp2f polynomials (relative error ~1e-7), 0 when x is 0 */
+#define LOG_POLY(P, x, z, MUL, ADD, SET) \
+  P = SET(7.0376836292E-2f); \
+  P = ADD(MUL(P, x), SET(-1.1514610310E-1f)); \
+  P = ADD(MUL(P, x), SET(1.1676998740E-1f)); \
+  P = ADD(MUL(P, x), SET(-1.2420140846E-1f)); \
+  P = ADD(MUL(P, x), SET(1.4249322787E-1f)); \
+  P = ADD(MUL(P, x), SET(-1.6668057665E-1f)); \
+  P = ADD(MUL(P, x), SET(2.0000714765E-1f)); \
+  P = ADD(MUL(P, x), SET(-2.4999993993E-1f)); \
+  P = ADD(MUL(P, x), SET(3.3333331174E-1f)); \
+  P = MUL(MUL(P, x), z)
+
+#define EXP2_POLY(P, x, MUL, ADD, SET) \
+  P = SET(1.535336188319500E-4f); \
+  P = ADD(MUL(P, x), SET(1.339887440266574E-3f)); \
+  P = ADD(MUL(P, x), SET(9.618437357674640E-3f)); \
+  P = ADD(MUL(P, x), SET(5.550332471162809E-2f)); \
+  P = ADD(MUL(P, x), SET(2.402264791363012E-1f)); \
+  P = ADD(MUL(P, x), SET(6.931472028550421E-1f)); \
+  P = ADD(MUL(P, x), SET(1.0f))
+
+static __m128 powSSE(__m128 x, __m128 y)
+{
+  __m128 valid = _mm_cmpgt_ps(x, _mm_setzero_ps());
+  x = _mm_max_ps(x, _mm_set1_ps(1.17549435e-38f));
+
+  /* log2(x): split into exponent and mantissa in [sqrt(0.5), sqrt(2)) */
+  __m128i bits = _mm_castps_si128(x);
+  __m128i e = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+  __m128 m = _mm_castsi128_ps(_mm_or_si128(
+    _mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000)));
+  __m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+  m = _mm_or_ps(_mm_andnot_ps(big, m), _mm_and_ps(big, _mm_mul_ps(m, _mm_set1_ps(0.5f))));
+  __m128 fe = _mm_add_ps(_mm_cvtepi32_ps(e), _mm_and_ps(big, _mm_set1_ps(1.0f)));
+  __m128 t = _mm_sub_ps(m, _mm_set1_ps(1.0f));
+  __m128 z = _mm_mul_ps(t, t);
+  __m128 p;
+  LOG_POLY(p, t, z, _mm_mul_ps, _mm_add_ps, _mm_set1_ps);
+  p = _mm_sub_ps(p, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+  __m128 lg = _mm_add_ps(_mm_mul_ps(_mm_add_ps(t, p), _mm_set1_ps(1.44269504f)), fe);
+
+  /* exp2(y * log2(x)), integer part goes straight into the exponent */
+  __m128 a = _mm_max_ps(_mm_mul_ps(y, lg), _mm_set1_ps(-126.0f));
+  __m128i i = _mm_cvtps_epi32(a);
+  __m128 f = _mm_sub_ps(a, _mm_cvtepi32_ps(i));
+  EXP2_POLY(p, f, _mm_mul_ps, _mm_add_ps, _mm_set1_ps);
+  __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23));
+
+  return _mm_and_ps(valid, _mm_mul_ps(p, scale));
+}
+
+static void lightSSE(const LightingParams* params, int n,
+  const float* px, const float* py, const float* pz,
+  const float* nx, const float* ny, const float* nz,
+  float* r, float* g, float* b)
+{
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+  const __m128 shininess = _mm_set1_ps(params->shininess);
+  int i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m128 Px = _mm_loadu_ps(px + i), Py = _mm_loadu_ps(py + i), Pz = _mm_loadu_ps(pz + i);
+    __m128 Nx = _mm_loadu_ps(nx + i), Ny = _mm_loadu_ps(ny + i), Nz = _mm_loadu_ps(nz + i);
+
+    __m128 lx = _mm_set1_ps(LIGHT), ly = lx, lz = lx;
+    __m128 vx = zero, vy = zero, vz = one;
+    if (params->positional) {
+      lx = _mm_sub_ps(lx, Px);
+      ly = _mm_sub_ps(ly, Py);
+      lz = _mm_sub_ps(lz, Pz);
+      vx = _mm_sub_ps(vx, Px);
+      vy = _mm_sub_ps(vy, Py);
+      vz = _mm_sub_ps(vz, Pz);
+    }
+
+    __m128 dp = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Nx, lx), _mm_mul_ps(Ny, ly)), _mm_mul_ps(Nz, lz));
+    __m128 lit = _mm_cmpgt_ps(dp, zero);
+
+    __m128 inv = _mm_div_ps(one, _mm_sqrt_ps(
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(Nx, Nx), _mm_mul_ps(Ny, Ny)), _mm_mul_ps(Nz, Nz))));
+    __m128 ux = _mm_mul_ps(Nx, inv), uy = _mm_mul_ps(Ny, inv), uz = _mm_mul_ps(Nz, inv);
+    __m128 NdotL = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ux, lx), _mm_mul_ps(uy, ly)), _mm_mul_ps(uz, lz));
+
+    __m128 cosAlpha;
+    if (params->phong) {
+      __m128 twoNdotL = _mm_add_ps(NdotL, NdotL);
+      __m128 Rx = _mm_sub_ps(_mm_mul_ps(twoNdotL, ux), lx);
+      __m128 Ry = _mm_sub_ps(_mm_mul_ps(twoNdotL, uy), ly);
+      __m128 Rz = _mm_sub_ps(_mm_mul_ps(twoNdotL, uz), lz);
+      __m128 Rlen = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(Rx, Rx), _mm_mul_ps(Ry, Ry)), _mm_mul_ps(Rz, Rz)));
+      cosAlpha = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, Rx), _mm_mul_ps(vy, Ry)), _mm_mul_ps(vz, Rz)), Rlen);
+    }
+    else {
+      __m128 Hx = _mm_add_ps(lx, vx), Hy = _mm_add_ps(ly, vy), Hz = _mm_add_ps(lz, vz);
+      __m128 Hlen = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(Hx, Hx), _mm_mul_ps(Hy, Hy)), _mm_mul_ps(Hz, Hz)));
+      cosAlpha = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ux, Hx), _mm_mul_ps(uy, Hy)), _mm_mul_ps(uz, Hz)), Hlen);
+    }
+    cosAlpha = _mm_max_ps(cosAlpha, zero);
+
+    __m128 spec = _mm_and_ps(lit, _mm_mul_ps(_mm_set1_ps(SPECULAR), powSSE(cosAlpha, shininess)));
+    __m128 diffuse = _mm_and_ps(lit, _mm_mul_ps(_mm_set1_ps(DIFFUSE), NdotL));
+    __m128 red = _mm_add_ps(_mm_set1_ps(AMBIENT), spec);
+    __m128 cyan = _mm_add_ps(red, diffuse);
+
+    _mm_storeu_ps(r + i, red);
+    _mm_storeu_ps(g + i, cyan);
+    _mm_storeu_ps(b + i, cyan);
+  }
+
+  lightScalar(params, n - i, px + i, py + i, pz + i, nx + i, ny + i, nz + i, r + i, g + i, b + i);
+}
+
+#define AVX2 __attribute__((target("avx2,fma")))
+
+AVX2 static __m256 powAVX2(__m256 x, __m256 y)
+{
+  __m256 valid = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ);
+  x = _mm256_max_ps(x, _mm256_set1_ps(1.17549435e-38f));
+
+  /* log2(x): split into exponent and mantissa in [sqrt(0.5), sqrt(2)) */
+  __m256i bits = _mm256_castps_si256(x);
+  __m256i e = _mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127));
+  __m256 m = _mm256_castsi256_ps(_mm256_or_si256(
+    _mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000)));
+  __m256 big = _mm256_cmp_ps(m, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ);
+  m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), big);
+  __m256 fe = _mm256_add_ps(_mm256_cvtepi32_ps(e), _mm256_and_ps(big, _mm256_set1_ps(1.0f)));
+  __m256 t = _mm256_sub_ps(m, _mm256_set1_ps(1.0f));
+  __m256 z = _mm256_mul_ps(t, t);
+  __m256 p;
+  LOG_POLY(p, t, z, _mm256_mul_ps, _mm256_add_ps, _mm256_set1_ps);
+  p = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), p);
+  __m256 lg = _mm256_fmadd_ps(_mm256_add_ps(t, p), _mm256_set1_ps(1.44269504f), fe);
+
+  /* exp2(y * log2(x)), integer part goes straight into the exponent */
+  __m256 a = _mm256_max_ps(_mm256_mul_ps(y, lg), _mm256_set1_ps(-126.0f));
+  __m256i i = _mm256_cvtps_epi32(a);
+  __m256 f = _mm256_sub_ps(a, _mm256_cvtepi32_ps(i));
+  EXP2_POLY(p, f, _mm256_mul_ps, _mm256_add_ps, _mm256_set1_ps);
+  __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(i, _mm256_set1_epi32(127)), 23));
+
+  return _mm256_and_ps(valid, _mm256_mul_ps(p, scale));
+}
+
+AVX2 static __m256 dot3AVX2(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz)
+{
+  return _mm256_fmadd_ps(az, bz, _mm256_fmadd_ps(ay, by, _mm256_mul_ps(ax, bx)));
+}
+
+AVX2 static void lightAVX2(const LightingParams* params, int n,
+  const float* px, const float* py, const float* pz,
+  const float* nx, const float* ny, const float* nz,
+  float* r, float* g, float* b)
+{
+  const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+  const __m256 shininess = _mm256_set1_ps(params->shininess);
+  int i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m256 Px = _mm256_loadu_ps(px + i), Py = _mm256_loadu_ps(py + i), Pz = _mm256_loadu_ps(pz + i);
+    __m256 Nx = _mm256_loadu_ps(nx + i), Ny = _mm256_loadu_ps(ny + i), Nz = _mm256_loadu_ps(nz + i);
+
+    __m256 lx = _mm256_set1_ps(LIGHT), ly = lx, lz = lx;
+    __m256 vx = zero, vy = zero, vz = one;
+    if (params->positional) {
+      lx = _mm256_sub_ps(lx, Px);
+      ly = _mm256_sub_ps(ly, Py);
+      lz = _mm256_sub_ps(lz, Pz);
+      vx = _mm256_sub_ps(vx, Px);
+      vy = _mm256_sub_ps(vy, Py);
+      vz = _mm256_sub_ps(vz, Pz);
+    }
+
+    __m256 dp = dot3AVX2(Nx, Ny, Nz, lx, ly, lz);
+    __m256 lit = _mm256_cmp_ps(dp, zero, _CMP_GT_OQ);
+
+    __m256 inv = _mm256_div_ps(one, _mm256_sqrt_ps(dot3AVX2(Nx, Ny, Nz, Nx, Ny, Nz)));
+    __m256 ux = _mm256_mul_ps(Nx, inv), uy = _mm256_mul_ps(Ny, inv), uz = _mm256_mul_ps(Nz, inv);
+    __m256 NdotL = dot3AVX2(ux, uy, uz, lx, ly, lz);
+
+    __m256 cosAlpha;
+    if (params->phong) {
+      __m256 twoNdotL = _mm256_add_ps(NdotL, NdotL);
+      __m256 Rx = _mm256_fmsub_ps(twoNdotL, ux, lx);
+      __m256 Ry = _mm256_fmsub_ps(twoNdotL, uy, ly);
+      __m256 Rz = _mm256_fmsub_ps(twoNdotL, uz, lz);
+      __m256 Rlen = _mm256_sqrt_ps(dot3AVX2(Rx, Ry, Rz, Rx, Ry, Rz));
+      cosAlpha = _mm256_div_ps(dot3AVX2(vx, vy, vz, Rx, Ry, Rz), Rlen);
+    }
+    else {
+      __m256 Hx = _mm256_add_ps(lx, vx), Hy = _mm256_add_ps(ly, vy), Hz = _mm256_add_ps(lz, vz);
+      __m256 Hlen = _mm256_sqrt_ps(dot3AVX2(Hx, Hy, Hz, Hx, Hy, Hz));
+      cosAlpha = _mm256_div_ps(dot3AVX2(ux, uy, uz, Hx, Hy, Hz), Hlen);
+    }
+    cosAlpha = _mm256_max_ps(cosAlpha, zero);
+
+    __m256 spec = _mm256_and_ps(lit, _mm256_mul_ps(_mm256_set1_ps(SPECULAR), powAVX2(cosAlpha, shininess)));
+    __m256 diffuse = _mm256_and_ps(lit, _mm256_mul_ps(_mm256_set1_ps(DIFFUSE), NdotL));
+    __m256 red = _mm256_add_ps(_mm256_set1_ps(AMBIENT), spec);
+    __m256 cyan = _mm256_add_ps(red, diffuse);
+
+    _mm256_storeu_ps(r + i, red);
+    _mm256_storeu_ps(g + i, cyan);
+    _mm256_storeu_ps(b + i, cyan);
+  }
+
+  lightScalar(params, n - i, px + i, py + i, pz + i, nx + i, ny + i, nz + i, r + i, g + i, b + i);
+}
+#endif
+
+static LightingKernel kernel;
+static const char* kernelName;
+
+static void selectKernel(void)
+{
+  kernel = lightScalar;
+  kernelName = "scalar";
+#ifdef LIGHTING_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    kernel = lightAVX2;
+    kernelName = "avx2";
+  }
+  else if (__builtin_cpu_supports("sse2")) {
+    kernel = lightSSE;
+    kernelName = "sse";
+  }
+#endif
+}
+
+void computeLightingSoA(const LightingParams* params, int n,
+  const float* px, const float* py, const float* pz,
+  const float* nx, const float* ny, const float* nz,
+  float* r, float* g, float* b)
+{
+  if (!kernel)
+    selectKernel();
+  kernel(params, n, px, py, pz, nx, ny, nz, r, g, b);
+}
+
+const char* lightingPath(void)
+{
+  if (!kernel)
+    selectKernel();
+  return kernelName;
+}
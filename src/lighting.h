@@ -0,0 +1,35 @@
+/*
+Batch ADS (ambient, diffuse and specular) lighting on the CPU.
+
+use computeLightingSoA() to light n vertices given in eye coordinates as
+structure of arrays, the same calculation as shader.vert/shader.frag.
+The SSE/AVX2 kernel is picked at runtime, lightingPath() names it.
+*/
+
+#ifndef LIGHTING_H
+#define LIGHTING_H
+
+#if __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct {
+  float shininess;
+  int phong;       /* Phong (reflection vector) instead of Blinn-Phong specular */
+  int positional;  /* positional light/viewer instead of directional */
+} LightingParams;
+
+void computeLightingSoA(const LightingParams* params, int n,
+  const float* px, const float* py, const float* pz,
+  const float* nx, const float* ny, const float* nz,
+  float* r, float* g, float* b);
+const char* lightingPath(void);
+
+
+#if __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,11 @@
+//lines330.frag
+#version 330 core
+
+in vec3 vColor;
+
+out vec4 fragColor;
+
+void main(void)
+{
+  fragColor = vec4(vColor, 1.0);
+}
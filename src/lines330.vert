@@ -0,0 +1,15 @@
+//lines330.vert
+#version 330 core
+
+// Colored lines (the axes) for the core profile, in place of glBegin/glColor
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 2) in vec3 aColor;
+
+out vec3 vColor;
+
+void main(void)
+{
+  gl_Position = uProjectionMat * uModelViewMat * vec4(aPosition, 1.0);
+  vColor = aColor;
+}
@@ -0,0 +1,45 @@
+//multiview.vert
+#version 410 compatibility
+#extension GL_ARB_shader_viewport_layer_array : require
+
+// shader.vert drawing every view of the multiview at once: instance i of the
+// draw is transformed by the matrices of view i and sent to viewport i
+
+out vec3 vColor, vPosition, vNormal;
+// Grid point, for shader.frag to light with the maps' normal there (uDimension
+// 5), and the matrix taking normals to eye coordinates
+out vec2 vGrid;
+flat out mat3 vNormalMat;
+
+void main(void)
+{
+  // Selected without indexing by gl_InstanceID, which is slow on llvmpipe
+  mat4 modelViewMat = uViewMat[0];
+  mat3 normalMat = uViewNormalMat[0];
+  for (int i = 1; i < NUM_VIEWS; i++) {
+    if (gl_InstanceID == i) {
+      modelViewMat = uViewMat[i];
+      normalMat = uViewNormalMat[i];
+    }
+  }
+
+  // x and z from gl_Vertex (or gl_VertexID), y and the normal from the wave
+  vec4 v = uTesselation > 0 ? gridVertex(gl_VertexID) : gl_Vertex;
+  vec3 osNormal;
+  vec4 osVert = waveVertex(v, osNormal);
+  vec4 esVert = modelViewMat * osVert;
+  vec4 csVert = uProjectionMat * esVert;
+  gl_Position = csVert;
+  gl_ViewportIndex = gl_InstanceID;
+
+  // shader.frag takes the normal to eye coordinates with the view's matrix
+  vPosition = vec3(esVert);
+  vNormal = osNormal;
+  vGrid = osVert.xz;
+  vNormalMat = normalMat;
+
+  if (uFixed && !uPixel)
+    vColor = computeLighting(vPosition, normalMat * normalize(osNormal));
+  else
+    vColor = vec3(gl_Color);
+}
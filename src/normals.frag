@@ -0,0 +1,9 @@
+//normals.frag
+#version 150 compatibility
+
+// Normals are drawn yellow, as drawVector() draws them
+
+void main(void)
+{
+  gl_FragColor = vec4(1.0, 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,19 @@
+//normals.vert
+#version 150 compatibility
+
+// First half of the normals pass: each vertex of the mesh, drawn as points,
+// is placed on the wave as in shader.vert and its normal found the same way,
+// normals.geom then turns it into a line
+
+out vec3 vNormal;
+
+void main(void)
+{
+  vec4 v = uLod ? chunkVertex(gl_VertexID, gl_InstanceID) : uTesselation > 0 ? gridPoint(gl_VertexID) : gl_Vertex;
+  vec3 n;
+  vec4 osVert = waveVertex(v, n);
+
+  // Eye coordinates, projected in normals.geom
+  gl_Position = uModelViewMat * osVert;
+  vNormal = normalize(uNormalMat * normalize(n));
+}
@@ -0,0 +1,19 @@
+//normals330.vert
+#version 330 core
+
+// normals.vert for the core profile
+
+layout(location = 0) in vec3 aPosition;
+
+out vec3 vNormal;
+
+void main(void)
+{
+  vec4 v = uLod ? chunkVertex(gl_VertexID, gl_InstanceID) : uTesselation > 0 ? gridPoint(gl_VertexID) : vec4(aPosition, 1.0);
+  vec3 n;
+  vec4 osVert = waveVertex(v, n);
+
+  // Eye coordinates, projected in normals330.geom
+  gl_Position = uModelViewMat * osVert;
+  vNormal = normalize(uNormalMat * normalize(n));
+}
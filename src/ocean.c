@@ -0,0 +1,487 @@
+/* FFT ocean, scalar reference plus SSE/AVX2 butterflies */
+
+#include <math.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#	define OCEAN_X86 1
+#	include <immintrin.h>
+#endif
+
+#include "ocean.h"
+
+/* Transforms run down OCEAN_LANES adjacent columns of the planes at once, the
+ * rows being the axis transformed, so the butterflies of each lane are the
+ * same and are done a vector at a time */
+#define OCEAN_LANES 8
+
+typedef void (*OceanKernel)(const Ocean* ocean, float* re, float* im);
+
+/* Waves shorter than wavelength / SHORTEST are damped, the shortest of the
+ * Gerstner spectrum (see spectrum.c), so the sea looks the same at any size */
+#define SHORTEST 8.0f
+
+/* Same sequence on every platform, so every run draws the same sea */
+static float random01(unsigned* seed)
+{
+  *seed = *seed * 1664525u + 1013904223u;
+  return (float) (*seed >> 8) / 16777216.0f;
+}
+
+/* Two independent standard normal deviates (Box-Muller) */
+static void gaussian(unsigned* seed, float* a, float* b)
+{
+  const float pi = 3.14159265358979f;
+  float r = sqrtf(-2.0f * logf(1.0f - random01(seed)));
+  float theta = 2.0f * pi * random01(seed);
+
+  *a = r * cosf(theta);
+  *b = r * sinf(theta);
+}
+
+static int reverseBits(int i, int bits)
+{
+  int r = 0;
+
+  while (bits--) {
+    r = r << 1 | (i & 1);
+    i >>= 1;
+  }
+  return r;
+}
+
+/* Frequency (n, m) of the maps is the wavenumber k = pi (n - size / 2, m -
+ * size / 2), the square being 2 wide, so a wave repeats a whole number of
+ * times across it. The Phillips spectrum of the wind W along x,
+ *   P(k) = exp(-1 / (k L)^2) / k^4 (k.W / |k|)^2 exp(-(k l)^2),
+ * is the largest at k = 1 / (L sqrt(2)), L is chosen so that is the
+ * wavenumber of wavelength, and l damps the waves shorter than SHORTEST. */
+void makeOcean(Ocean* ocean, int size, float amplitude, float wavelength)
+{
+  const float pi = 3.14159265358979f;
+  float L = wavelength / (2.0f * pi * sqrtf(2.0f)), l = wavelength / (2.0f * pi * SHORTEST);
+  float sum = 0.0f, sum4 = 0.0f, sum6 = 0.0f, scale;
+  unsigned seed = 1;
+  int n, m, i;
+
+  ocean->size = size;
+  for (ocean->log2Size = 0; (1 << ocean->log2Size) < size; ocean->log2Size++)
+    ;
+  ocean->t = -1.0f;
+  ocean->height = 0.0f;
+  ocean->texels = (float*) calloc(3 * size * size, sizeof(float));
+  ocean->h0 = (float*) calloc(2 * size * size, sizeof(float));
+  ocean->omega = (float*) calloc(size * size, sizeof(float));
+  ocean->twiddle = (float*) calloc(size, sizeof(float));
+  for (i = 0; i < 8; i++)
+    ocean->work[i] = (float*) calloc(size * size, sizeof(float));
+  ocean->rowHeight = (float*) calloc(size, sizeof(float));
+
+  for (m = 0; m < size; m++)
+    for (n = 0; n < size; n++) {
+      float kx = pi * (n - size / 2), kz = pi * (m - size / 2);
+      float k2 = kx * kx + kz * kz, k = sqrtf(k2);
+      float* h0 = &ocean->h0[2 * (m * size + n)];
+      float a, b;
+
+      gaussian(&seed, &a, &b);
+      /* the most negative frequencies (n or m 0) are left out, their
+       * opposites aren't in the maps so their slopes couldn't be real */
+      if (k2 == 0.0f || n == 0 || m == 0)
+        continue;
+      float P = expf(-1.0f / (k2 * L * L)) / (k2 * k2) * (kx * kx / k2) * expf(-k2 * l * l);
+      h0[0] = a * sqrtf(P / 2.0f);
+      h0[1] = b * sqrtf(P / 2.0f);
+      /* deep water dispersion, speed ~ sqrt(k), waves of wavelength as fast as the sines */
+      ocean->omega[m * size + n] = 0.25f * sqrtf(k * wavelength / (2.0f * pi));
+
+      /* height (and its derivatives) on average, h0(k) and h0(-k) both
+       * making up the wave of frequency k */
+      float e = 2.0f * (h0[0] * h0[0] + h0[1] * h0[1]);
+      sum += e;
+      sum4 += e * k2 * k2;
+      sum6 += e * k2 * k2 * k2;
+    }
+
+  /* as high on average as a sine of amplitude, whose mean square is A^2 / 2 */
+  scale = sum > 0.0f ? amplitude / sqrtf(2.0f * sum) : 0.0f;
+  for (i = 0; i < 2 * size * size; i++)
+    ocean->h0[i] *= scale;
+  ocean->curvature = 3.0f * scale * sqrtf(sum4);
+  ocean->curvatureRate = 3.0f * scale * sqrtf(sum6);
+
+  for (i = 0; i < size / 2; i++) {
+    ocean->twiddle[2 * i] = cosf(2.0f * pi * i / size);
+    ocean->twiddle[2 * i + 1] = sinf(2.0f * pi * i / size);
+  }
+}
+
+void freeOcean(Ocean* ocean)
+{
+  int i;
+
+  free(ocean->texels);
+  free(ocean->h0);
+  free(ocean->omega);
+  free(ocean->twiddle);
+  for (i = 0; i < 8; i++)
+    free(ocean->work[i]);
+  free(ocean->rowHeight);
+  ocean->texels = ocean->h0 = ocean->omega = ocean->twiddle = ocean->rowHeight = NULL;
+  for (i = 0; i < 8; i++)
+    ocean->work[i] = NULL;
+}
+
+/* Inverse FFT down OCEAN_LANES columns from re/im, whose rows are in bit
+ * reversed order, decimation in time. Two radix-2 stages of spans h and 2h
+ * are done together as one radix-4 stage (3 complex multiplies for the 4
+ * points rather than 4), with a radix-2 stage first when log2Size is odd.
+ * For 4 points h apart, w1 = w(2h)^j, w2 = w(4h)^j and w(4h)^h = i:
+ *   b0, b1 = x0 +- w1 x1, b2, b3 = x2 +- w1 x3
+ *   x0, x2 = b0 +- w2 b2, x1, x3 = b1 +- i w2 b3 */
+static void fftScalar(const Ocean* ocean, float* re, float* im)
+{
+  int size = ocean->size, h, j, q, l;
+
+  if (ocean->log2Size & 1)
+    for (q = 0; q < size; q += 2) {
+      float* r0 = re + q * size, * i0 = im + q * size;
+      float* r1 = r0 + size, * i1 = i0 + size;
+      for (l = 0; l < OCEAN_LANES; l++) {
+        float ar = r0[l], ai = i0[l], br = r1[l], bi = i1[l];
+        r0[l] = ar + br;
+        i0[l] = ai + bi;
+        r1[l] = ar - br;
+        i1[l] = ai - bi;
+      }
+    }
+
+  for (h = ocean->log2Size & 1 ? 2 : 1; h < size; h *= 4)
+    for (j = 0; j < h; j++) {
+      const float* w1 = &ocean->twiddle[2 * (j * (size / (2 * h)))];
+      const float* w2 = &ocean->twiddle[2 * (j * (size / (4 * h)))];
+      for (q = j; q < size; q += 4 * h) {
+        float* r0 = re + q * size, * i0 = im + q * size;
+        float* r1 = r0 + h * size, * i1 = i0 + h * size;
+        float* r2 = r1 + h * size, * i2 = i1 + h * size;
+        float* r3 = r2 + h * size, * i3 = i2 + h * size;
+        for (l = 0; l < OCEAN_LANES; l++) {
+          float ar = r1[l] * w1[0] - i1[l] * w1[1], ai = r1[l] * w1[1] + i1[l] * w1[0];
+          float cr = r3[l] * w1[0] - i3[l] * w1[1], ci = r3[l] * w1[1] + i3[l] * w1[0];
+          float b0r = r0[l] + ar, b0i = i0[l] + ai, b1r = r0[l] - ar, b1i = i0[l] - ai;
+          float b2r = r2[l] + cr, b2i = i2[l] + ci, b3r = r2[l] - cr, b3i = i2[l] - ci;
+          float dr = b2r * w2[0] - b2i * w2[1], di = b2r * w2[1] + b2i * w2[0];
+          float er = -(b3r * w2[1] + b3i * w2[0]), ei = b3r * w2[0] - b3i * w2[1];
+          r0[l] = b0r + dr;
+          i0[l] = b0i + di;
+          r2[l] = b0r - dr;
+          i2[l] = b0i - di;
+          r1[l] = b1r + er;
+          i1[l] = b1i + ei;
+          r3[l] = b1r - er;
+          i3[l] = b1i - ei;
+        }
+      }
+    }
+}
+
+#ifdef OCEAN_X86
+static void fftSSE(const Ocean* ocean, float* re, float* im)
+{
+  int size = ocean->size, h, j, q, l;
+
+  if (ocean->log2Size & 1)
+    for (q = 0; q < size; q += 2) {
+      float* r0 = re + q * size, * i0 = im + q * size;
+      float* r1 = r0 + size, * i1 = i0 + size;
+      for (l = 0; l < OCEAN_LANES; l += 4) {
+        __m128 ar = _mm_loadu_ps(r0 + l), ai = _mm_loadu_ps(i0 + l);
+        __m128 br = _mm_loadu_ps(r1 + l), bi = _mm_loadu_ps(i1 + l);
+        _mm_storeu_ps(r0 + l, _mm_add_ps(ar, br));
+        _mm_storeu_ps(i0 + l, _mm_add_ps(ai, bi));
+        _mm_storeu_ps(r1 + l, _mm_sub_ps(ar, br));
+        _mm_storeu_ps(i1 + l, _mm_sub_ps(ai, bi));
+      }
+    }
+
+  for (h = ocean->log2Size & 1 ? 2 : 1; h < size; h *= 4)
+    for (j = 0; j < h; j++) {
+      const float* w1 = &ocean->twiddle[2 * (j * (size / (2 * h)))];
+      const float* w2 = &ocean->twiddle[2 * (j * (size / (4 * h)))];
+      __m128 w1r = _mm_set1_ps(w1[0]), w1i = _mm_set1_ps(w1[1]);
+      __m128 w2r = _mm_set1_ps(w2[0]), w2i = _mm_set1_ps(w2[1]);
+      for (q = j; q < size; q += 4 * h) {
+        float* r0 = re + q * size, * i0 = im + q * size;
+        float* r1 = r0 + h * size, * i1 = i0 + h * size;
+        float* r2 = r1 + h * size, * i2 = i1 + h * size;
+        float* r3 = r2 + h * size, * i3 = i2 + h * size;
+        for (l = 0; l < OCEAN_LANES; l += 4) {
+          __m128 x1r = _mm_loadu_ps(r1 + l), x1i = _mm_loadu_ps(i1 + l);
+          __m128 x3r = _mm_loadu_ps(r3 + l), x3i = _mm_loadu_ps(i3 + l);
+          __m128 ar = _mm_sub_ps(_mm_mul_ps(x1r, w1r), _mm_mul_ps(x1i, w1i));
+          __m128 ai = _mm_add_ps(_mm_mul_ps(x1r, w1i), _mm_mul_ps(x1i, w1r));
+          __m128 cr = _mm_sub_ps(_mm_mul_ps(x3r, w1r), _mm_mul_ps(x3i, w1i));
+          __m128 ci = _mm_add_ps(_mm_mul_ps(x3r, w1i), _mm_mul_ps(x3i, w1r));
+          __m128 x0r = _mm_loadu_ps(r0 + l), x0i = _mm_loadu_ps(i0 + l);
+          __m128 x2r = _mm_loadu_ps(r2 + l), x2i = _mm_loadu_ps(i2 + l);
+          __m128 b0r = _mm_add_ps(x0r, ar), b0i = _mm_add_ps(x0i, ai);
+          __m128 b1r = _mm_sub_ps(x0r, ar), b1i = _mm_sub_ps(x0i, ai);
+          __m128 b2r = _mm_add_ps(x2r, cr), b2i = _mm_add_ps(x2i, ci);
+          __m128 b3r = _mm_sub_ps(x2r, cr), b3i = _mm_sub_ps(x2i, ci);
+          __m128 dr = _mm_sub_ps(_mm_mul_ps(b2r, w2r), _mm_mul_ps(b2i, w2i));
+          __m128 di = _mm_add_ps(_mm_mul_ps(b2r, w2i), _mm_mul_ps(b2i, w2r));
+          __m128 er = _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(_mm_mul_ps(b3r, w2i), _mm_mul_ps(b3i, w2r)));
+          __m128 ei = _mm_sub_ps(_mm_mul_ps(b3r, w2r), _mm_mul_ps(b3i, w2i));
+          _mm_storeu_ps(r0 + l, _mm_add_ps(b0r, dr));
+          _mm_storeu_ps(i0 + l, _mm_add_ps(b0i, di));
+          _mm_storeu_ps(r2 + l, _mm_sub_ps(b0r, dr));
+          _mm_storeu_ps(i2 + l, _mm_sub_ps(b0i, di));
+          _mm_storeu_ps(r1 + l, _mm_add_ps(b1r, er));
+          _mm_storeu_ps(i1 + l, _mm_add_ps(b1i, ei));
+          _mm_storeu_ps(r3 + l, _mm_sub_ps(b1r, er));
+          _mm_storeu_ps(i3 + l, _mm_sub_ps(b1i, ei));
+        }
+      }
+    }
+}
+
+#define AVX2 __attribute__((target("avx2,fma")))
+
+AVX2 static void fftAVX2(const Ocean* ocean, float* re, float* im)
+{
+  int size = ocean->size, h, j, q;
+
+  if (ocean->log2Size & 1)
+    for (q = 0; q < size; q += 2) {
+      float* r0 = re + q * size, * i0 = im + q * size;
+      float* r1 = r0 + size, * i1 = i0 + size;
+      __m256 ar = _mm256_loadu_ps(r0), ai = _mm256_loadu_ps(i0);
+      __m256 br = _mm256_loadu_ps(r1), bi = _mm256_loadu_ps(i1);
+      _mm256_storeu_ps(r0, _mm256_add_ps(ar, br));
+      _mm256_storeu_ps(i0, _mm256_add_ps(ai, bi));
+      _mm256_storeu_ps(r1, _mm256_sub_ps(ar, br));
+      _mm256_storeu_ps(i1, _mm256_sub_ps(ai, bi));
+    }
+
+  for (h = ocean->log2Size & 1 ? 2 : 1; h < size; h *= 4)
+    for (j = 0; j < h; j++) {
+      const float* w1 = &ocean->twiddle[2 * (j * (size / (2 * h)))];
+      const float* w2 = &ocean->twiddle[2 * (j * (size / (4 * h)))];
+      __m256 w1r = _mm256_set1_ps(w1[0]), w1i = _mm256_set1_ps(w1[1]);
+      __m256 w2r = _mm256_set1_ps(w2[0]), w2i = _mm256_set1_ps(w2[1]);
+      for (q = j; q < size; q += 4 * h) {
+        float* r0 = re + q * size, * i0 = im + q * size;
+        float* r1 = r0 + h * size, * i1 = i0 + h * size;
+        float* r2 = r1 + h * size, * i2 = i1 + h * size;
+        float* r3 = r2 + h * size, * i3 = i2 + h * size;
+        __m256 x1r = _mm256_loadu_ps(r1), x1i = _mm256_loadu_ps(i1);
+        __m256 x3r = _mm256_loadu_ps(r3), x3i = _mm256_loadu_ps(i3);
+        __m256 ar = _mm256_fmsub_ps(x1r, w1r, _mm256_mul_ps(x1i, w1i));
+        __m256 ai = _mm256_fmadd_ps(x1r, w1i, _mm256_mul_ps(x1i, w1r));
+        __m256 cr = _mm256_fmsub_ps(x3r, w1r, _mm256_mul_ps(x3i, w1i));
+        __m256 ci = _mm256_fmadd_ps(x3r, w1i, _mm256_mul_ps(x3i, w1r));
+        __m256 x0r = _mm256_loadu_ps(r0), x0i = _mm256_loadu_ps(i0);
+        __m256 x2r = _mm256_loadu_ps(r2), x2i = _mm256_loadu_ps(i2);
+        __m256 b0r = _mm256_add_ps(x0r, ar), b0i = _mm256_add_ps(x0i, ai);
+        __m256 b1r = _mm256_sub_ps(x0r, ar), b1i = _mm256_sub_ps(x0i, ai);
+        __m256 b2r = _mm256_add_ps(x2r, cr), b2i = _mm256_add_ps(x2i, ci);
+        __m256 b3r = _mm256_sub_ps(x2r, cr), b3i = _mm256_sub_ps(x2i, ci);
+        __m256 dr = _mm256_fmsub_ps(b2r, w2r, _mm256_mul_ps(b2i, w2i));
+        __m256 di = _mm256_fmadd_ps(b2r, w2i, _mm256_mul_ps(b2i, w2r));
+        __m256 er = _mm256_fnmsub_ps(b3r, w2i, _mm256_mul_ps(b3i, w2r));
+        __m256 ei = _mm256_fmsub_ps(b3r, w2r, _mm256_mul_ps(b3i, w2i));
+        _mm256_storeu_ps(r0, _mm256_add_ps(b0r, dr));
+        _mm256_storeu_ps(i0, _mm256_add_ps(b0i, di));
+        _mm256_storeu_ps(r2, _mm256_sub_ps(b0r, dr));
+        _mm256_storeu_ps(i2, _mm256_sub_ps(b0i, di));
+        _mm256_storeu_ps(r1, _mm256_add_ps(b1r, er));
+        _mm256_storeu_ps(i1, _mm256_add_ps(b1i, ei));
+        _mm256_storeu_ps(r3, _mm256_sub_ps(b1r, er));
+        _mm256_storeu_ps(i3, _mm256_sub_ps(b1i, ei));
+      }
+    }
+}
+#endif
+
+static OceanKernel kernel;
+static const char* kernelName;
+
+static void selectKernel(void)
+{
+  kernel = fftScalar;
+  kernelName = "scalar";
+#ifdef OCEAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    kernel = fftAVX2;
+    kernelName = "avx2";
+  }
+  else if (__builtin_cpu_supports("sse2")) {
+    kernel = fftSSE;
+    kernelName = "sse";
+  }
+#endif
+}
+
+/* The maps are the inverse transforms of the spectrum at time t,
+ *   h(k, t) = h0(k) e^(i omega t) + conj(h0(-k)) e^(-i omega t),
+ * and of the slopes' spectra i kx h and i kz h, all three real. Two real
+ * maps are made by one complex transform, h + i (slope along x) of
+ * h (1 - kx), slope along z by the second. The 2D transforms are 1D
+ * transforms down the columns (along kx, the spectrum being filled in
+ * transposed), a transpose, and 1D transforms down the columns again (along
+ * kz), the rows being put in bit reversed order as they are written. */
+static void fillRows(int begin, int end, void* data)
+{
+  Ocean* ocean = (Ocean*) data;
+  int size = ocean->size, n, m;
+
+  for (n = begin; n < end; n++) {
+    int row = reverseBits(n, ocean->log2Size) * size;
+    float kx = 3.14159265358979f * (n - size / 2);
+
+    for (m = 0; m < size; m++) {
+      const float* h = &ocean->h0[2 * (m * size + n)];
+      const float* g = &ocean->h0[2 * (((size - m) & (size - 1)) * size + ((size - n) & (size - 1)))];
+      float kz = 3.14159265358979f * (m - size / 2);
+      float theta = ocean->omega[m * size + n] * ocean->t;
+      float c = cosf(theta), s = sinf(theta);
+      /* (-1)^(n + m) moves the origin of the frequencies to the middle, and
+       * that of the maps to -1 with the (-1)^(i + j) in packTexels() */
+      float sign = (n + m) & 1 ? -1.0f : 1.0f;
+      float hr = sign * ((h[0] + g[0]) * c - (h[1] + g[1]) * s);
+      float hi = sign * ((h[0] - g[0]) * s + (h[1] - g[1]) * c);
+
+      ocean->work[0][row + m] = hr * (1.0f - kx);
+      ocean->work[1][row + m] = hi * (1.0f - kx);
+      ocean->work[2][row + m] = -kz * hi;
+      ocean->work[3][row + m] = kz * hr;
+    }
+  }
+}
+
+static void transformColumns(const Ocean* ocean, float** planes, int begin, int end)
+{
+  int group;
+
+  for (group = begin; group < end; group++) {
+    kernel(ocean, planes[0] + group * OCEAN_LANES, planes[1] + group * OCEAN_LANES);
+    kernel(ocean, planes[2] + group * OCEAN_LANES, planes[3] + group * OCEAN_LANES);
+  }
+}
+
+static void transformSpectrum(int begin, int end, void* data)
+{
+  Ocean* ocean = (Ocean*) data;
+
+  transformColumns(ocean, ocean->work, begin, end);
+}
+
+static void transformTransposes(int begin, int end, void* data)
+{
+  Ocean* ocean = (Ocean*) data;
+
+  transformColumns(ocean, ocean->work + 4, begin, end);
+}
+
+/* Rows of the transposes a block of OCEAN_LANES at a time, each row of the
+ * planes being read once per block */
+static void transpose(int begin, int end, void* data)
+{
+  Ocean* ocean = (Ocean*) data;
+  int size = ocean->size, block, i, l, p;
+
+  for (block = begin; block < end; block++) {
+    int rows[OCEAN_LANES];
+    for (l = 0; l < OCEAN_LANES; l++)
+      rows[l] = reverseBits(block * OCEAN_LANES + l, ocean->log2Size) * size;
+    for (p = 0; p < 4; p++) {
+      const float* src = ocean->work[p] + block * OCEAN_LANES;
+      float* dst = ocean->work[4 + p];
+      for (i = 0; i < size; i++)
+        for (l = 0; l < OCEAN_LANES; l++)
+          dst[rows[l] + i] = src[i * size + l];
+    }
+  }
+}
+
+static void packTexels(int begin, int end, void* data)
+{
+  Ocean* ocean = (Ocean*) data;
+  int size = ocean->size, i, j;
+
+  for (j = begin; j < end; j++) {
+    const float* a = ocean->work[4] + j * size, * b = ocean->work[5] + j * size;
+    const float* c = ocean->work[6] + j * size;
+    float* texel = ocean->texels + 3 * j * size;
+    float highest = 0.0f;
+
+    for (i = 0; i < size; i++) {
+      float sign = (i + j) & 1 ? -1.0f : 1.0f;
+      texel[3 * i] = sign * a[i];
+      texel[3 * i + 1] = sign * b[i];
+      texel[3 * i + 2] = sign * c[i];
+      highest = fmaxf(highest, fabsf(a[i]));
+    }
+    ocean->rowHeight[j] = highest;
+  }
+}
+
+static void run(OceanParallelFor parallel, int n, int grain, OceanWorker fn, void* data)
+{
+  if (parallel)
+    parallel(n, grain, fn, data);
+  else
+    fn(0, n, data);
+}
+
+void updateOcean(Ocean* ocean, float t, OceanParallelFor parallel)
+{
+  int groups = ocean->size / OCEAN_LANES, j;
+
+  if (!kernel)
+    selectKernel();
+  ocean->t = t;
+  run(parallel, ocean->size, 8, fillRows, ocean);
+  run(parallel, groups, 1, transformSpectrum, ocean);
+  run(parallel, groups, 1, transpose, ocean);
+  run(parallel, groups, 1, transformTransposes, ocean);
+  run(parallel, ocean->size, 8, packTexels, ocean);
+
+  ocean->height = 0.0f;
+  for (j = 0; j < ocean->size; j++)
+    ocean->height = fmaxf(ocean->height, ocean->rowHeight[j]);
+}
+
+void sampleOcean(const Ocean* ocean, float x, float z, float* height, float* slopeX, float* slopeZ)
+{
+  int size = ocean->size, mask = size - 1, c;
+  float u = (x + 1.0f) * size / 2.0f, v = (z + 1.0f) * size / 2.0f;
+  float fu = floorf(u), fv = floorf(v);
+  int i0 = (int) fu & mask, j0 = (int) fv & mask;
+  int i1 = (i0 + 1) & mask, j1 = (j0 + 1) & mask;
+  float s = u - fu, t = v - fv;
+  const float* t00 = ocean->texels + 3 * (j0 * size + i0), * t01 = ocean->texels + 3 * (j0 * size + i1);
+  const float* t10 = ocean->texels + 3 * (j1 * size + i0), * t11 = ocean->texels + 3 * (j1 * size + i1);
+  float r[3];
+
+  for (c = 0; c < 3; c++)
+    r[c] = (1.0f - t) * ((1.0f - s) * t00[c] + s * t01[c]) + t * ((1.0f - s) * t10[c] + s * t11[c]);
+  *height = r[0];
+  *slopeX = r[1];
+  *slopeZ = r[2];
+}
+
+void oceanBounds(const Ocean* ocean, float* amplitude, float* curvature, float* curvatureRate)
+{
+  *amplitude = ocean->height;
+  *curvature = ocean->curvature;
+  *curvatureRate = ocean->curvatureRate;
+}
+
+const char* oceanPath(void)
+{
+  if (!kernel)
+    selectKernel();
+  return kernelName;
+}
@@ -0,0 +1,65 @@
+/*
+Tessendorf's spectral ocean, the wave of dimension 5: a Phillips spectrum of
+wind driven waves over the [-1,1] square, brought to a time and transformed
+by inverse FFT into maps of the height and its slopes.
+
+use makeOcean() to allocate an ocean of size x size texels (a power of 2,
+OCEAN_MIN_SIZE to OCEAN_MAX_SIZE) and fill its spectrum, the wind along x,
+its longest waves about wavelength long and as high on average as a sine of
+amplitude, freeOcean() to release it
+use updateOcean() for the maps at time t, each pass of the transform split
+over threads by parallel (parallelFor(), see workers.h) or serial for NULL;
+texels then holds size x size (height, slope along x, slope along z), row by
+row along z, for the grid points from -1 a step of 2 / size apart, repeating
+use sampleOcean() for the height and slopes anywhere, interpolated as a
+GL_LINEAR, GL_REPEAT texture of the texels is
+use oceanBounds() for how far the surface is from the grid (the highest
+texel) and bounds of its curvature and of the curvature's rate of change
+(three standard deviations)
+The SSE/AVX2 butterflies are picked at runtime, oceanPath() names them.
+*/
+
+#ifndef OCEAN_H
+#define OCEAN_H
+
+#if __cplusplus
+extern "C" {
+#endif
+
+
+#define OCEAN_MIN_SIZE 16
+#define OCEAN_MAX_SIZE 1024
+
+typedef void (*OceanWorker)(int begin, int end, void* data);
+typedef void (*OceanParallelFor)(int n, int grain, OceanWorker fn, void* data);
+
+typedef struct {
+  int size, log2Size;
+  float t;              /* time of the texels, -1 before the first update */
+  float* texels;
+  float height;         /* highest |height| of the texels */
+  float curvature, curvatureRate;
+
+  /* the rest is private to ocean.c */
+  float* h0;            /* spectrum at time 0, complex, row by row along kz */
+  float* omega;         /* angular frequency of each wavenumber */
+  float* twiddle;       /* cos and sin of 2 pi i / size, i < size / 2 */
+  float* work[8];       /* real and imaginary planes of the two transforms,
+                           then of their transposes */
+  float* rowHeight;     /* highest |height| of each row of texels */
+} Ocean;
+
+void makeOcean(Ocean* ocean, int size, float amplitude, float wavelength);
+void freeOcean(Ocean* ocean);
+void updateOcean(Ocean* ocean, float t, OceanParallelFor parallel);
+void sampleOcean(const Ocean* ocean, float x, float z, float* height, float* slopeX, float* slopeZ);
+void oceanBounds(const Ocean* ocean, float* amplitude, float* curvature, float* curvatureRate);
+const char* oceanPath(void);
+
+
+#if __cplusplus
+}
+#endif
+
+
+#endif
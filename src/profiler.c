@@ -0,0 +1,266 @@
+/* Per-stage CPU/GPU frame profiler, see profiler.h */
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "profiler.h"
+
+typedef struct {
+  int stage;
+  double cpuBegin, cpuEnd;   /* ms, cpuEnd < 0 while the interval is open */
+} ProfileEvent;
+
+/* Everything recorded in one frame, reused every PROFILE_FRAMES frames */
+typedef struct {
+  int count;
+  int pending;               /* finished, queries not read back yet */
+  double begin, end;
+  ProfileEvent events[PROFILE_EVENTS];
+  GLuint queries[2 * PROFILE_EVENTS];  /* GL_TIMESTAMP at begin/end of each event */
+} ProfileFrame;
+
+static struct {
+  int initialized;
+  int timer;                 /* GL timestamp queries available */
+  int stages;
+  const char* names[PROFILE_MAX_STAGES];
+  int open[PROFILE_MAX_STAGES];        /* event of the open interval, -1 if none */
+  ProfileFrame frames[PROFILE_FRAMES];
+  int current;
+
+  /* Sums since the last profileSummary() */
+  double cpuTotal[PROFILE_MAX_STAGES], gpuTotal[PROFILE_MAX_STAGES];
+  int totalFrames;
+
+  FILE* trace;
+  int traceEvents;
+  double traceStart;         /* CPU ms the trace starts at */
+  double gpuOffset;          /* add to GPU ms to get CPU ms */
+} prof;
+
+static double profileNow(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1.0e6;
+}
+
+static int hasTimerQuery(void)
+{
+  GLint major = 0, minor = 0, count = 0, i;
+
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  if (major * 10 + minor >= 33)
+    return 1;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (i = 0; i < count; i++)
+    if (strcmp((const char*) glGetStringi(GL_EXTENSIONS, i), "GL_ARB_timer_query") == 0)
+      return 1;
+  return 0;
+}
+
+void profileInit(int stages, const char* const* names)
+{
+  int i;
+
+  if (stages > PROFILE_MAX_STAGES)
+    stages = PROFILE_MAX_STAGES;
+  memset(&prof, 0, sizeof prof);
+  prof.stages = stages;
+  for (i = 0; i < stages; i++) {
+    prof.names[i] = names[i];
+    prof.open[i] = -1;
+  }
+
+  prof.timer = hasTimerQuery();
+  if (prof.timer)
+    for (i = 0; i < PROFILE_FRAMES; i++)
+      glGenQueries(2 * PROFILE_EVENTS, prof.frames[i].queries);
+
+  prof.frames[0].begin = profileNow();
+  prof.initialized = 1;
+}
+
+void profileShutdown(void)
+{
+  int i;
+
+  if (!prof.initialized)
+    return;
+  profileTraceStop();
+  if (prof.timer)
+    for (i = 0; i < PROFILE_FRAMES; i++)
+      glDeleteQueries(2 * PROFILE_EVENTS, prof.frames[i].queries);
+  prof.initialized = 0;
+}
+
+void profileBegin(int stage)
+{
+  ProfileFrame* frame = &prof.frames[prof.current];
+  ProfileEvent* e;
+
+  if (!prof.initialized || stage < 0 || stage >= prof.stages)
+    return;
+  /* Intervals beyond PROFILE_EVENTS in a frame are not timed */
+  if (frame->count == PROFILE_EVENTS) {
+    prof.open[stage] = -1;
+    return;
+  }
+
+  e = &frame->events[frame->count];
+  e->stage = stage;
+  e->cpuBegin = profileNow();
+  e->cpuEnd = -1.0;
+  if (prof.timer)
+    glQueryCounter(frame->queries[2 * frame->count], GL_TIMESTAMP);
+  prof.open[stage] = frame->count++;
+}
+
+void profileEnd(int stage)
+{
+  ProfileFrame* frame = &prof.frames[prof.current];
+  int i;
+
+  if (!prof.initialized || stage < 0 || stage >= prof.stages || prof.open[stage] < 0)
+    return;
+
+  i = prof.open[stage];
+  if (prof.timer)
+    glQueryCounter(frame->queries[2 * i + 1], GL_TIMESTAMP);
+  frame->events[i].cpuEnd = profileNow();
+  prof.open[stage] = -1;
+}
+
+static void traceEvent(const char* name, int gpu, double begin, double end)
+{
+  if (begin < prof.traceStart)
+    return;
+  fprintf(prof.trace, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+    "\"dur\":%.3f,\"pid\":1,\"tid\":%d}", prof.traceEvents ? ",\n" : "",
+    name, gpu ? "gpu" : "cpu", (begin - prof.traceStart) * 1000.0,
+    (end - begin) * 1000.0, gpu ? 2 : 1);
+  prof.traceEvents++;
+}
+
+/* Read back a finished frame's timestamps (normally available by now, since
+ * PROFILE_FRAMES frames have been submitted after it) and add it to the sums */
+static void resolveFrame(ProfileFrame* frame)
+{
+  int i;
+
+  for (i = 0; i < frame->count; i++) {
+    ProfileEvent* e = &frame->events[i];
+    if (e->cpuEnd < 0.0)
+      continue;
+    prof.cpuTotal[e->stage] += e->cpuEnd - e->cpuBegin;
+    if (prof.trace)
+      traceEvent(prof.names[e->stage], 0, e->cpuBegin, e->cpuEnd);
+
+    if (prof.timer) {
+      GLuint64 begin, end;
+      glGetQueryObjectui64v(frame->queries[2 * i], GL_QUERY_RESULT, &begin);
+      glGetQueryObjectui64v(frame->queries[2 * i + 1], GL_QUERY_RESULT, &end);
+      prof.gpuTotal[e->stage] += (end - begin) / 1.0e6;
+      if (prof.trace)
+        traceEvent(prof.names[e->stage], 1,
+          begin / 1.0e6 + prof.gpuOffset, end / 1.0e6 + prof.gpuOffset);
+    }
+  }
+  if (prof.trace)
+    traceEvent("frame", 0, frame->begin, frame->end);
+
+  prof.totalFrames++;
+  frame->pending = 0;
+}
+
+void profileFrame(void)
+{
+  ProfileFrame* frame;
+  int i;
+
+  if (!prof.initialized)
+    return;
+
+  frame = &prof.frames[prof.current];
+  frame->end = profileNow();
+  frame->pending = 1;
+  for (i = 0; i < prof.stages; i++)
+    prof.open[i] = -1;
+
+  /* The slot about to be reused holds the frame from PROFILE_FRAMES ago */
+  prof.current = (prof.current + 1) % PROFILE_FRAMES;
+  frame = &prof.frames[prof.current];
+  if (frame->pending)
+    resolveFrame(frame);
+  frame->count = 0;
+  frame->begin = profileNow();
+}
+
+int profileSummary(float* cpuMs, float* gpuMs)
+{
+  int frames = prof.totalFrames, i;
+
+  for (i = 0; i < prof.stages; i++) {
+    cpuMs[i] = frames ? prof.cpuTotal[i] / frames : 0.0;
+    gpuMs[i] = !prof.timer ? -1.0 : frames ? prof.gpuTotal[i] / frames : 0.0;
+    prof.cpuTotal[i] = 0.0;
+    prof.gpuTotal[i] = 0.0;
+  }
+  prof.totalFrames = 0;
+  return frames;
+}
+
+int profileTraceStart(const char* filename)
+{
+  if (!prof.initialized)
+    return 0;
+  profileTraceStop();
+
+  prof.trace = fopen(filename, "w");
+  if (!prof.trace)
+    return 0;
+  prof.traceEvents = 0;
+  prof.traceStart = profileNow();
+  if (prof.timer) {
+    GLint64 gpuNow;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+    prof.gpuOffset = profileNow() - gpuNow / 1.0e6;
+  }
+
+  fprintf(prof.trace, "{\"traceEvents\":[\n"
+    "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n"
+    "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+  prof.traceEvents = 1;
+  return 1;
+}
+
+void profileTraceStop(void)
+{
+  int i, slot;
+
+  if (!prof.trace)
+    return;
+
+  /* Frames still in flight are read back now rather than lost */
+  for (i = 1; i <= PROFILE_FRAMES; i++) {
+    slot = (prof.current + i) % PROFILE_FRAMES;
+    if (prof.frames[slot].pending)
+      resolveFrame(&prof.frames[slot]);
+  }
+
+  fprintf(prof.trace, "\n]}\n");
+  fclose(prof.trace);
+  prof.trace = NULL;
+}
+
+int profileTracing(void)
+{
+  return prof.trace != NULL;
+}
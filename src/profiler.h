@@ -0,0 +1,43 @@
+/*
+Per-stage CPU and GPU frame profiler.
+
+use profileInit() once a GL context exists, naming the stages to be timed
+use profileBegin()/profileEnd() around each stage (may repeat in a frame,
+e.g. once per view, the times are summed)
+use profileFrame() after the frame is finished; GPU timestamps are read back
+PROFILE_FRAMES frames late so the CPU doesn't wait on the GPU
+use profileSummary() for the average ms per frame of each stage since the
+last call, GPU times are negative if timer queries are unsupported
+use profileTraceStart()/profileTraceStop() to record a Chrome trace-event
+JSON file (chrome://tracing, ui.perfetto.dev)
+*/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#if __cplusplus
+extern "C" {
+#endif
+
+
+#define PROFILE_MAX_STAGES 16
+#define PROFILE_FRAMES 4      /* frames in flight before queries are read */
+#define PROFILE_EVENTS 128    /* timed intervals per frame */
+
+void profileInit(int stages, const char* const* names);
+void profileShutdown(void);
+void profileBegin(int stage);
+void profileEnd(int stage);
+void profileFrame(void);
+int profileSummary(float* cpuMs, float* gpuMs);
+int profileTraceStart(const char* filename);
+void profileTraceStop(void);
+int profileTracing(void);
+
+
+#if __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,25 @@
+//shader330.frag
+#version 330 core
+
+in vec3 vColor, vPosition, vNormal;
+in vec2 vGrid;
+flat in mat3 vNormalMat;
+
+out vec4 fragColor;
+
+void main (void)
+{
+  int pos = uPositional ? 1 : 0;
+
+  if (uLighting) {
+    if (uFixed && uPixel) {
+      // The maps' normal at the pixel, rather than interpolated from the vertices
+      vec3 n = uDimension == 5 ? heightmapNormal(vGrid) : vNormal;
+      fragColor = vec4(computeLighting(vPosition, vNormalMat * normalize(n)), pos);
+    }
+    else
+      fragColor = vec4(vColor, pos);
+  }
+  else
+    fragColor = vec4(vec3(0.0, 1.0, 1.0), pos);
+}
@@ -0,0 +1,39 @@
+//shader330.vert
+#version 330 core
+
+// shader.vert for the core profile, generic attributes in place of
+// gl_Vertex/gl_Color
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec3 aColor;
+
+out vec3 vColor, vPosition, vNormal;
+// Grid point, for shader.frag to light with the maps' normal there (uDimension
+// 5), and the matrix taking normals to eye coordinates
+out vec2 vGrid;
+flat out mat3 vNormalMat;
+
+void main(void)
+{
+  // x and z from aPosition (or gl_VertexID), y and the normal from the wave,
+  // the grid's own normal otherwise
+  vec4 v = uLod ? chunkVertex(gl_VertexID, gl_InstanceID) : uTesselation > 0 ? gridVertex(gl_VertexID) : vec4(aPosition, 1.0);
+  vec3 n;
+  vec4 osVert = waveVertex(v, n);
+  if (uDimension == 0 && uTesselation == 0)
+    n = aNormal;
+  vec4 esVert = uModelViewMat * osVert;
+  vec4 csVert = uProjectionMat * esVert;
+  gl_Position = csVert;
+
+  vPosition = vec3(esVert);
+  vNormal = n;
+  vGrid = osVert.xz;
+  vNormalMat = uNormalMat;
+
+  if (uFixed && !uPixel)
+    vColor = computeLighting(vPosition, uNormalMat * normalize(vNormal));
+  else
+    vColor = aColor;
+}
@@ -17,6 +17,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#if _WIN32
+#	include <direct.h>
+#	include <process.h>
+#	define getpid _getpid
+#else
+#	include <unistd.h>
+#endif
 
 #include "shaders.h"
 
@@ -24,6 +32,22 @@
 #pragma warning(disable:4996)
 #endif
 
+/* GL_KHR_parallel_shader_compile, -1 until checked */
+static int parallelCompile = -1;
+
+/* program binary cache, see setProgramCache() */
+static struct {
+  char directory[256];
+  int enabled;
+  int hits, misses;
+} cache;
+
+/* source every shader gets ahead of its own, see setShaderCommon() */
+static struct {
+  char* defines;     /* NULL if none */
+  const char* file;  /* NULL if none */
+} common;
+
 int oglError(int line, const char* file)
 {
   GLenum glErr;
@@ -31,7 +55,7 @@ int oglError(int line, const char* file)
   while ((glErr = glGetError()) != GL_NO_ERROR) {
     /* extract file name from path */
     const char* p = strrchr(file, '\\');
-    if (p > 0) file = p+1;
+    if (p) file = p+1;
     /* print the error message */
     printf("glError 0x%x in %s at %i: %s\n", glErr, file, line, gluErrorString(glErr));
     retCode = 1;
@@ -107,67 +131,424 @@ char* readFile(const char* filename)
   return data;
 }
 
-void cleanupShader(GLuint vert, GLuint frag, char *vertSrc, char *fragSrc)
+/* the stages of a program, in ShaderBuild's order */
+static const GLenum stageTypes[SHADER_STAGES] = {
+  GL_VERTEX_SHADER, GL_TESS_CONTROL_SHADER, GL_TESS_EVALUATION_SHADER,
+  GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER
+};
+
+void cleanupShaders(GLuint program, const GLuint* shaders)
 {
-  glDeleteShader(vert);
-  glDeleteShader(frag);
-  free(vertSrc);
-  free(fragSrc);
+  int i;
+
+  for (i = 0; i < SHADER_STAGES; i++)
+    if (shaders[i]) {
+      glDetachShader(program, shaders[i]);
+      glDeleteShader(shaders[i]);
+    }
 }
 
-GLuint getShader(const char* vertexFile, const char* fragmentFile)
+/* pass the source to the shader with the defines (may be NULL) and the common
+ * source (may be NULL) inserted after its #version line, which has to come
+ * first, and any #extension lines following it. The common source is
+ * numbered as source string 1 in compile errors, and the shader's own lines
+ * keep their numbers */
+void shaderSource(GLuint shader, const char* src, const char* defines, const char* commonSource)
 {
-  char* vertSrc;
-  char* fragSrc;
+  const GLchar* strings[7];
+  GLint lengths[7];
+  const char* version;
+  const char* rest = src;
+  char commonLine[32], restLine[32];
+  int i, lines = 0;
 
-  CHECK_GL_ERROR;
+  if (!defines && !common.defines && !commonSource) {
+    glShaderSource(shader, 1, (const GLchar**)&src, NULL);
+    return;
+  }
+
+  version = strstr(src, "#version");
+  if (version) {
+    rest = strchr(version, '\n');
+    rest = rest ? rest + 1 : version + strlen(version);
+    while (strncmp(rest, "#extension", 10) == 0) {
+      const char* end = strchr(rest, '\n');
+      rest = end ? end + 1 : rest + strlen(rest);
+    }
+  }
+  for (i = 0; src + i < rest; i++)
+    lines += src[i] == '\n';
 
-  /* read the contents of the source files */
-  vertSrc = readFile(vertexFile);
-  fragSrc = readFile(fragmentFile);
+  /* #line gives the number of the next line from GLSL 3.30, of the line
+   * before it until then */
+  snprintf(commonLine, sizeof commonLine, "\n#line %d 1\n", version && atoi(version + 8) >= 330 ? 1 : 0);
+  snprintf(restLine, sizeof restLine, "\n#line %d 0\n", version && atoi(version + 8) >= 330 ? lines + 1 : lines);
 
-  /* check they exist */
-  if (!vertSrc || !fragSrc) {
-    free(vertSrc);
-    free(fragSrc);
-    printf("Error reading shaders %s & %s\n", vertexFile, fragmentFile);
-    fflush(stdout);
-    return 0;
+  strings[0] = src;
+  strings[1] = defines ? defines : "";
+  strings[2] = common.defines ? common.defines : "";
+  strings[3] = commonSource ? commonLine : "";
+  strings[4] = commonSource ? commonSource : "";
+  strings[5] = commonSource ? restLine : "";
+  strings[6] = rest;
+  lengths[0] = rest - src;
+  for (i = 1; i < 7; i++)
+    lengths[i] = strlen(strings[i]);
+  glShaderSource(shader, 7, strings, lengths);
+}
+
+void setShaderCommon(const char* defines, const char* file)
+{
+  free(common.defines);
+  common.defines = defines ? strdup(defines) : NULL;
+  common.file = file;
+}
+
+/* directory and any of its parents that are missing */
+static void makeDirectories(const char* directory)
+{
+  char path[256];
+  char* p;
+
+  snprintf(path, sizeof path, "%s", directory);
+  for (p = path + 1; *p; p++) {
+    if (*p != '/')
+      continue;
+    *p = '\0';
+#if _WIN32
+    _mkdir(path);
+#else
+    mkdir(path, 0755);
+#endif
+    *p = '/';
   }
+#if _WIN32
+  _mkdir(path);
+#else
+  mkdir(path, 0755);
+#endif
+}
 
-  /* create the shaders */
-  GLuint vert, frag, program;
-  vert = glCreateShader(GL_VERTEX_SHADER);
-  frag = glCreateShader(GL_FRAGMENT_SHADER);
+void setProgramCache(const char* directory)
+{
+  GLint formats = 0;
 
-  /* pass in the source code for the shaders */
-  glShaderSource(vert, 1, (const GLchar**)&vertSrc, NULL);
-  glShaderSource(frag, 1, (const GLchar**)&fragSrc, NULL);
+  cache.enabled = 0;
+  if (!directory)
+    return;
 
-  /* compile and check each for errors */
-  glCompileShader(vert);
-  if (shaderError(vert, vertexFile)) {
-    cleanupShader(vert, frag, vertSrc, fragSrc);
+  /* drivers may support the call but no binary formats */
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  if (formats < 1) {
+    printf("program cache: no program binary formats\n");
+    return;
+  }
+  makeDirectories(directory);
+  snprintf(cache.directory, sizeof cache.directory, "%s", directory);
+  cache.enabled = 1;
+}
+
+void getProgramCacheStats(int* hits, int* misses)
+{
+  *hits = cache.hits;
+  *misses = cache.misses;
+}
+
+/* 64-bit FNV-1a, continuing from hash */
+static unsigned long long hashString(unsigned long long hash, const char* s)
+{
+  if (!s)
+    s = "";
+  for (; *s; s++) {
+    hash ^= (unsigned char) *s;
+    hash *= 0x100000001b3ULL;
+  }
+  /* separate the strings, so "ab"+"c" and "a"+"bc" differ */
+  hash ^= 0xff;
+  hash *= 0x100000001b3ULL;
+  return hash;
+}
+
+/* cache file of a program, from everything its binary depends on */
+static void cachePath(char* path, size_t size, char* const* sources, const char* defines,
+  const char* commonSource)
+{
+  unsigned long long hash = 0xcbf29ce484222325ULL;
+
+  hash = hashString(hash, sources[s_vertex]);
+  hash = hashString(hash, sources[s_geometry]);
+  hash = hashString(hash, sources[s_fragment]);
+  hash = hashString(hash, defines);
+  hash = hashString(hash, common.defines);
+  hash = hashString(hash, commonSource);
+  /* only when used, so programs without them keep their cache files */
+  if (sources[s_tessControl] || sources[s_tessEvaluation]) {
+    hash = hashString(hash, sources[s_tessControl]);
+    hash = hashString(hash, sources[s_tessEvaluation]);
+  }
+  hash = hashString(hash, (const char*) glGetString(GL_RENDERER));
+  hash = hashString(hash, (const char*) glGetString(GL_VERSION));
+  snprintf(path, size, "%s/%016llx.bin", cache.directory, hash);
+}
+
+typedef struct {
+  char magic[4];     /* "PBIN" */
+  GLenum format;
+  GLint length;
+} CacheHeader;
+
+/* program from a cached binary, 0 if missing or not accepted by the driver
+ * (stale, e.g. after a driver update, or corrupt) */
+static GLuint loadProgramBinary(const char* path)
+{
+  CacheHeader header;
+  GLuint program;
+  GLint success = 0;
+  void* binary;
+  FILE* file = fopen(path, "rb");
+
+  if (!file)
+    return 0;
+  if (fread(&header, sizeof header, 1, file) != 1 || memcmp(header.magic, "PBIN", 4) != 0 ||
+      header.length <= 0) {
+    fclose(file);
     return 0;
   }
-  glCompileShader(frag);
-  if (shaderError(frag, fragmentFile)) {
-    cleanupShader(vert, frag, vertSrc, fragSrc);
+  binary = malloc(header.length);
+  if (fread(binary, 1, header.length, file) != (size_t) header.length) {
+    free(binary);
+    fclose(file);
     return 0;
   }
+  fclose(file);
 
-  /* create program, attach shaders, link and check for errors */
   program = glCreateProgram();
-  glAttachShader(program, vert);
-  glAttachShader(program, frag);
-  glLinkProgram(program);
-  if (programError(program, vertexFile, fragmentFile)) {
-    cleanupShader(vert, frag, vertSrc, fragSrc);
+  glProgramBinary(program, header.format, binary, header.length);
+  free(binary);
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  /* a rejected binary is an error to the driver, not to us */
+  while (glGetError() != GL_NO_ERROR)
+    ;
+  if (!success) {
     glDeleteProgram(program);
     return 0;
   }
+  return program;
+}
+
+static void saveProgramBinary(const char* path, GLuint program)
+{
+  CacheHeader header;
+  char tmpPath[300];
+  void* binary;
+  FILE* file;
+
+  memcpy(header.magic, "PBIN", 4);
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &header.length);
+  if (header.length <= 0)
+    return;
+  binary = malloc(header.length);
+  glGetProgramBinary(program, header.length, NULL, &header.format, binary);
+
+  /* written aside and renamed, so other instances never read half a file */
+  snprintf(tmpPath, sizeof tmpPath, "%s.%ld.tmp", path, (long) getpid());
+  file = fopen(tmpPath, "wb");
+  if (file) {
+    int ok = fwrite(&header, sizeof header, 1, file) == 1 &&
+      fwrite(binary, 1, header.length, file) == (size_t) header.length;
+    if (fclose(file) == 0 && ok)
+      rename(tmpPath, path);
+    else
+      remove(tmpPath);
+  }
+  free(binary);
+}
+
+/* compiling and linking returns before the driver has finished when it
+ * compiles in the background, GL_COMPLETION_STATUS_KHR tells when it has */
+int hasParallelCompile(void)
+{
+  GLint count = 0, i;
+
+  if (parallelCompile < 0) {
+    parallelCompile = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (i = 0; i < count; i++) {
+      const char* name = (const char*) glGetStringi(GL_EXTENSIONS, i);
+      if (strcmp(name, "GL_KHR_parallel_shader_compile") == 0 ||
+          strcmp(name, "GL_ARB_parallel_shader_compile") == 0)
+        parallelCompile = 1;
+    }
+  }
+  return parallelCompile;
+}
+
+GLuint getShader(const char* vertexFile, const char* fragmentFile)
+{
+  return getShaderVariant(vertexFile, NULL, fragmentFile, NULL);
+}
+
+GLuint getGeometryShader(const char* vertexFile, const char* geometryFile, const char* fragmentFile)
+{
+  return getShaderVariant(vertexFile, geometryFile, fragmentFile, NULL);
+}
+
+GLuint getShaderVariant(const char* vertexFile, const char* geometryFile, const char* fragmentFile,
+  const char* defines)
+{
+  ShaderBuild build;
+
+  if (!startShaderBuild(&build, vertexFile, geometryFile, fragmentFile, defines))
+    return 0;
+  return finishShaderBuild(&build); /* NOTE: use glDeleteProgram to free resources */
+}
+
+GLuint getTessShader(const char* vertexFile, const char* tessControlFile, const char* tessEvaluationFile,
+  const char* fragmentFile)
+{
+  ShaderBuild build;
+
+  if (!startTessShaderBuild(&build, vertexFile, tessControlFile, tessEvaluationFile, fragmentFile, NULL))
+    return 0;
+  return finishShaderBuild(&build);
+}
+
+/* what the build functions share, files[] indexed by ShaderStages */
+int startBuild(ShaderBuild* build, const char* const* files, const char* defines)
+{
+  char* sources[SHADER_STAGES];
+  char* commonSource;
+  GLuint program;
+  int i, missing = 0;
+
+  CHECK_GL_ERROR;
+  memset(build, 0, sizeof *build);
+  memcpy(build->files, files, sizeof build->files);
+
+  /* read the contents of the source files, and check they exist */
+  for (i = 0; i < SHADER_STAGES; i++) {
+    sources[i] = files[i] ? readFile(files[i]) : NULL;
+    if (files[i] && !sources[i])
+      missing = 1;
+  }
+  commonSource = common.file ? readFile(common.file) : NULL;
+  if (common.file && !commonSource)
+    missing = 1;
+  if (missing) {
+    printf("Error reading shaders");
+    for (i = 0; i < SHADER_STAGES; i++) {
+      if (files[i])
+        printf(" %s", files[i]);
+      free(sources[i]);
+    }
+    if (common.file)
+      printf(" %s", common.file);
+    free(commonSource);
+    printf("\n");
+    fflush(stdout);
+    return 0;
+  }
+
+  /* a binary of the same sources built by this driver before */
+  if (cache.enabled) {
+    cachePath(build->cachePath, sizeof build->cachePath, sources, defines, commonSource);
+    program = loadProgramBinary(build->cachePath);
+    if (program) {
+      cache.hits++;
+      build->program = program;
+      build->cachePath[0] = '\0';
+      for (i = 0; i < SHADER_STAGES; i++)
+        free(sources[i]);
+      free(commonSource);
+      return 1;
+    }
+    cache.misses++;
+  }
+
+  /* create the shaders and pass in their source code */
+  for (i = 0; i < SHADER_STAGES; i++) {
+    if (!sources[i])
+      continue;
+    build->shaders[i] = glCreateShader(stageTypes[i]);
+    shaderSource(build->shaders[i], sources[i], defines, commonSource);
+    free(sources[i]);
+  }
+  free(commonSource);
+
+  /* compile, create program, attach shaders and link, errors are checked
+   * by finishShaderBuild() so the driver can do this in the background */
+  for (i = 0; i < SHADER_STAGES; i++)
+    if (build->shaders[i])
+      glCompileShader(build->shaders[i]);
+  program = glCreateProgram();
+  for (i = 0; i < SHADER_STAGES; i++)
+    if (build->shaders[i])
+      glAttachShader(program, build->shaders[i]);
+  if (cache.enabled)
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  glLinkProgram(program);
+
+  build->program = program;
+  return 1;
+}
+
+int startShaderBuild(ShaderBuild* build, const char* vertexFile, const char* geometryFile,
+  const char* fragmentFile, const char* defines)
+{
+  const char* files[SHADER_STAGES] = { vertexFile, NULL, NULL, geometryFile, fragmentFile };
+
+  return startBuild(build, files, defines);
+}
+
+int startTessShaderBuild(ShaderBuild* build, const char* vertexFile, const char* tessControlFile,
+  const char* tessEvaluationFile, const char* fragmentFile, const char* defines)
+{
+  const char* files[SHADER_STAGES] = { vertexFile, tessControlFile, tessEvaluationFile, NULL, fragmentFile };
+
+  return startBuild(build, files, defines);
+}
+
+int shaderBuildDone(const ShaderBuild* build)
+{
+  GLint done = 1;
+
+  /* loaded from the cache, or the driver compiles before returning */
+  if (!build->shaders[s_vertex] || !hasParallelCompile())
+    return 1;
+  glGetProgramiv(build->program, GL_COMPLETION_STATUS_KHR, &done);
+  return done;
+}
+
+GLuint finishShaderBuild(ShaderBuild* build)
+{
+  GLuint program = build->program;
+  int failed = 0, i;
+
+  if (!build->shaders[s_vertex]) {
+    memset(build, 0, sizeof *build);
+    return program;
+  }
+
+  /* check each shader for errors, then the program */
+  for (i = 0; i < SHADER_STAGES && !failed; i++)
+    failed = build->shaders[i] && shaderError(build->shaders[i], build->files[i]);
+  failed = failed || programError(program, build->files[s_vertex], build->files[s_fragment]);
+
   /* clean up intermediates and return the program */
-  cleanupShader(vert, frag, vertSrc, fragSrc);
+  cleanupShaders(program, build->shaders);
+  if (failed) {
+    glDeleteProgram(program);
+    program = 0;
+  }
+  else if (build->cachePath[0])
+    saveProgramBinary(build->cachePath, program);
+  memset(build, 0, sizeof *build);
+  return program;
+}
 
-  return program; /* NOTE: use glDeleteProgram to free resources */
+void cancelShaderBuild(ShaderBuild* build)
+{
+  cleanupShaders(build->program, build->shaders);
+  glDeleteProgram(build->program);
+  memset(build, 0, sizeof *build);
 }
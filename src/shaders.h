@@ -4,6 +4,19 @@
 NOTE: make sure to call glewInit before loading shaders
 
 use getShader() to load, compile shaders and return a program
+use getGeometryShader() for a program with a geometry shader as well
+use getTessShader() for one with tessellation control and evaluation shaders
+use getShaderVariant() to compile them with #defines inserted after #version
+use setShaderCommon() for a GLSL file, and #defines ahead of it, that every
+shader gets after its #version and #extension lines (errors in it are reported
+as source string 1)
+use setProgramCache() to keep linked program binaries in a directory (made
+with its parents if missing), reused while the sources, defines, GL_RENDERER
+and GL_VERSION are the same
+use startShaderBuild() to compile and link without waiting for the driver,
+shaderBuildDone() to poll it (GL_KHR_parallel_shader_compile, always done
+without) and finishShaderBuild() for the program, 0 on errors; the file
+names must stay valid until then (startTessShaderBuild() with tessellation)
 use glUseProgram(program) to activate it
 use glUseProgram(0) to return to fixed pipeline rendering
 use glDeleteProgram() to free resources
@@ -20,6 +33,32 @@ extern "C" {
 #define CHECK_GL_ERROR oglError(__LINE__, __FILE__)
 int oglError(int line, const char* file);
 unsigned int getShader(const char* vertexFile, const char* fragmentFile);
+unsigned int getGeometryShader(const char* vertexFile, const char* geometryFile, const char* fragmentFile);
+unsigned int getTessShader(const char* vertexFile, const char* tessControlFile,
+  const char* tessEvaluationFile, const char* fragmentFile);
+unsigned int getShaderVariant(const char* vertexFile, const char* geometryFile, const char* fragmentFile,
+  const char* defines);
+void setShaderCommon(const char* defines, const char* file);
+void setProgramCache(const char* directory);
+void getProgramCacheStats(int* hits, int* misses);
+
+/* a program being compiled and linked */
+typedef enum { s_vertex, s_tessControl, s_tessEvaluation, s_geometry, s_fragment, SHADER_STAGES } ShaderStages;
+
+typedef struct {
+  unsigned int program;
+  unsigned int shaders[SHADER_STAGES];  /* 0 if unused, all 0 if loaded from the program cache */
+  const char* files[SHADER_STAGES];     /* NULL if unused */
+  char cachePath[300];                  /* binary saved here once linked, "" if not */
+} ShaderBuild;
+
+int startShaderBuild(ShaderBuild* build, const char* vertexFile, const char* geometryFile,
+  const char* fragmentFile, const char* defines);
+int startTessShaderBuild(ShaderBuild* build, const char* vertexFile, const char* tessControlFile,
+  const char* tessEvaluationFile, const char* fragmentFile, const char* defines);
+int shaderBuildDone(const ShaderBuild* build);
+unsigned int finishShaderBuild(ShaderBuild* build);
+void cancelShaderBuild(ShaderBuild* build);
 
 
 #if __cplusplus
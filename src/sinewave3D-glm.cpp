@@ -6,12 +6,29 @@
 // NOTE: need to be placed before #include, enables glUseProgram() to work
 #define GL_GLEXT_PROTOTYPES
 #include "shaders.h"
-
+#include "filewatch.h"
+#include "glstate.h"
+#include "lighting.h"
+#include "workers.h"
+#include "profiler.h"
+#include "spectrum.h"
+#include "ocean.h"
+
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <time.h>
+
+#include <algorithm>
 
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GL/glut.h>
+#include <GL/freeglut_ext.h>
 #include <GL/glu.h>
 #include <GL/gl.h>
 
@@ -25,12 +42,57 @@
 static int shaderProgram;
 static const char* vertexFile = "./shader.vert";
 static const char* fragmentFile = "./shader.frag";
-// Uniform locations for variables that are passed into the shader program;
-static GLint tesselationLoc, dimensionLoc;
-static GLint shineLoc, timeLoc;
-static GLint phongLoc, pixelLoc, positionalLoc, fixedLoc, flatLoc;
-static GLint normalMatLoc, modelViewMatLoc, projectionMatLoc;
-static GLint lightingLoc;
+// Single pass multiview program (0 if unsupported), shares shader.frag
+static int multiViewProgram;
+static const char* multiViewVertexFile = "./multiview.vert";
+// Normals pass (0 if unsupported), a line per vertex from the geometry shader
+static int normalsProgram;
+static const char* normalsVertexFile = "./normals.vert";
+static const char* normalsGeometryFile = "./normals.geom";
+static const char* normalsFragmentFile = "./normals.frag";
+// Tessellation shader mesh (0 if unsupported), a patch grid subdivided on the
+// GPU, shares shader.frag
+static int tessProgram;
+static const char* tessVertexFile = "./tess.vert";
+static const char* tessControlFile = "./tess.tesc";
+static const char* tessEvaluationFile = "./tess.tese";
+// Heightmap bake (0 if unsupported), the wave into a float texture that the
+// programs above then read, #version 150 so either profile can build it
+static int heightmapProgram;
+static const char* heightmapVertexFile = "./heightmap.vert";
+static const char* heightmapFragmentFile = "./heightmap.frag";
+// Core profile (--core) replacements of the above, #version 330 with generic
+// vertex attributes, and the program drawing the axes there
+static const char* coreVertexFile = "./shader330.vert";
+static const char* coreFragmentFile = "./shader330.frag";
+static const char* coreNormalsVertexFile = "./normals330.vert";
+static const char* coreNormalsGeometryFile = "./normals330.geom";
+static int linesProgram;
+static const char* linesVertexFile = "./lines330.vert";
+static const char* linesFragmentFile = "./lines330.frag";
+
+// Put in every shader ahead of its own source, see initShaderCommon()
+static const char* commonFile = "./common.glsl";
+
+// Linked programs are kept in this directory of the user's cache between
+// runs (see programCachePath()), NULL to always compile
+static const char* programCacheDir = "sinewave";
+
+// Generic vertex attribute locations of the #version 330 shaders
+typedef enum { a_position, a_normal, a_color } VertexAttribs;
+
+// Uniform locations for variables that are passed into a shader program,
+// other than those of the ShadingState block (see setShadingState())
+typedef struct {
+  GLint normalLength;              // normals program only
+  GLint lod;                       // drawing quadtree LOD chunks, see drawLodChunks()
+  GLint pixels;                    // tessellation program, see drawTessPatches()
+  GLint time, dimension, size;     // heightmap program, see bakeHeightmap()
+} Uniforms;
+
+static Uniforms shaderUniforms, multiViewUniforms, normalsUniforms, linesUniforms, tessUniforms;
+static Uniforms heightmapUniforms;
+static Uniforms* activeUniforms = &shaderUniforms;  // of the lighting program in use
 
 typedef enum {
   d_drawSineWave,
@@ -41,6 +103,8 @@ typedef enum {
   d_OSD,
   d_matrices,
   d_computeLighting,
+  d_rebuild,
+  d_shaders,
   d_nflags
 } DebugFlags;
 
@@ -54,11 +118,34 @@ bool debug[d_nflags] =
   false, // d_OSD
   false, // d_matrices
   false, // d_computeLighting
+  false, // d_rebuild
+  false, // d_shaders
 };
 
 typedef struct { float r, g, b; } color3f;
 
-typedef enum { FRAME, FLAGS, VALUES } OSD;
+typedef enum { FRAME, FLAGS, VALUES, PROFILE } OSD;
+
+// Stages timed by the profiler, shown on the PROFILE page of the OSD
+typedef enum {
+  p_build,    // mesh rows written to the vertex stream
+  p_ocean,    // FFT of the ocean's maps and their texture upload
+  p_bake,     // wave baked into the heightmap
+  p_upload,   // stream segment wait/map/unmap, index buffers, binding
+  p_draw,     // VBO draws, immediate mode (including its rows)
+  p_normals,
+  p_axes,
+  p_osd,
+  p_swap,
+  p_nstages
+} ProfileStages;
+
+const char* profileStageNames[p_nstages] =
+  { "build", "ocean", "bake", "upload", "draw", "normals", "axes", "osd", "swap" };
+
+// Per frame averages (ms) over the last stats interval, negative if no GPU timer
+float profileCpu[p_nstages], profileGpu[p_nstages];
+const char* traceFile = "trace.json";
 
 // Buffer offset used in VBOs, essentially the same as assignment 1
 #define BUFFER_OFFSET(i) ((void*)(i))
@@ -68,10 +155,58 @@ typedef struct {
   glm::vec3 pos, normal, color;
 } Vertex;
 
-Vertex *vertices;             // Store vertices for vbos
-unsigned int* indices;        // Store indices for vbos
-size_t numVerts, numIndices;  // Count number of vertices/indices
-unsigned vbo, ibo, cbo;       // Buffers
+Vertex *vertices;             // Mapped vertices being built for vbos
+size_t numVerts;              // Count number of vertices
+unsigned vbo, cbo;            // Buffers
+
+/* Vertices are streamed through a ring of STREAM_SEGMENTS segments in one
+ * buffer, persistently mapped (ARB_buffer_storage) so the mesh builders write
+ * straight into it. A fence per segment stops the CPU overwriting a segment
+ * the GPU may still be drawing from. Without buffer storage the buffer is
+ * orphaned and mapped for each rebuild instead. */
+#define STREAM_SEGMENTS 3
+
+typedef struct {
+  int tess;                 // tesselation of the mesh being streamed
+  size_t numVerts;          // vertices per segment, 0 when not allocated
+  int segment;              // segment last written and drawn from, -1 if none
+  GLsync fences[STREAM_SEGMENTS];
+  Vertex* mapped;           // whole ring when persistent
+  bool persistent;
+  GLuint vaos[STREAM_SEGMENTS];  // core profile, attributes of each segment
+} VertexStream;
+
+VertexStream stream = { 0, 0, -1, { 0, 0, 0 }, NULL, false, { 0, 0, 0 } };
+
+/* With vertexId on, the shaders make the mesh from gl_VertexID instead (see
+ * vertexIdMesh()), drawn with this vertex array that has no attributes */
+GLuint emptyVao;
+
+// Vertex array of the gl_VertexID mesh, the caller rebinds 0 when done
+void bindEmptyVertexArray()
+{
+  if (!emptyVao)
+    glGenVertexArrays(1, &emptyVao);
+  stateBindVertexArray(emptyVao);
+}
+
+/* Indices only depend on the tesselation (and layout), so they are kept
+ * resident per tess level rather than rebuilt with the vertices. 16-bit
+ * indices are used while every vertex can be addressed with them. The strip
+ * layout draws each row as a triangle strip ended by a primitive restart. */
+#define INDEX_CACHE_SIZE 6
+
+typedef struct {
+  int tess;          // 0 for an unused entry
+  bool strips;
+  GLuint buffer;
+  GLsizei count;
+  GLenum type;       // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+  unsigned lastUse;  // for evicting the least recently used entry
+} IndexBuffer;
+
+IndexBuffer indexCache[INDEX_CACHE_SIZE];
+unsigned indexCacheClock;
 
 typedef struct {
   bool animate;
@@ -102,6 +237,19 @@ typedef struct {
   bool wave;
   bool vbo;
   bool wireframe;
+  bool headless;
+  bool strips;
+  bool singlePass;
+  bool core;
+  bool uberShader;
+  bool vertexId;
+  bool lod;
+  bool tessShader;
+  bool cull;
+  int waves;
+  int oceanSize;
+  bool heightmap;
+  int heightmapSize;
 } Global;
 
 Global g =
@@ -137,6 +285,19 @@ Global g =
   false, // wave
   false, // vbo
   false, // wireframe
+  false, // headless
+  false, // strips
+  false, // singlePass
+  false, // core
+  false, // uberShader
+  false, // vertexId
+  false, // lod
+  false, // tessShader
+  true,  // cull
+  64,    // waves
+  256,   // oceanSize
+  false, // heightmap
+  256,   // heightmapSize
 };
 
 typedef enum { inactive, rotate, pan, zoom } CameraControl;
@@ -148,6 +309,23 @@ struct camera_t {
   CameraControl control;
 } camera = { 0, 0, 30.0, -30.0, 1.0, inactive };
 
+/* Classes of state change, by what has to be regenerated when they happen.
+ * Camera and animation time changes are detected from the matrices/time
+ * themselves, see updateVBOs() */
+typedef enum {
+  c_ui = 0,            // OSD, console, normals, multiview: nothing to rebuild
+  c_uniform = 1 << 0,  // shader uniforms or GL state only (flat, per pixel, strips)
+  c_lighting = 1 << 1, // lighting model (shininess, phong, positional)
+  c_geometry = 1 << 2, // shape, tesselation, dimension and lighting/shader modes
+} ChangeClass;
+
+unsigned pendingChanges = c_geometry;
+
+void markChanged(unsigned change)
+{
+  pendingChanges |= change;
+}
+
 // Colors defined
 glm::vec3 cyan(0.0, 1.0, 1.0);
 glm::vec3 cyanDiffuse(0.0, 0.5, 0.5);
@@ -161,6 +339,60 @@ const float milli = 1000.0;
 
 glm::mat4 modelViewMatrix;
 glm::mat3 normalMatrix;
+const glm::mat4 projectionMatrix = glm::ortho(-1.0, 1.0, -1.0, 1.0, -100.0, 100.0);
+
+// Views of displayMultiView()
+#define NUM_VIEWS 4
+
+// Quadtree LOD chunks, see selectLodChunks()
+#define LOD_CHUNK 32                 // quads per side of a chunk
+#define LOD_LEVELS 7                 // the finest, LOD_CHUNK << 6, being tess 2048
+#define LOD_MAX_CHUNKS (1 << 2 * (LOD_LEVELS - 1))
+#define LOD_BATCH 1024               // chunks an instanced draw, 16 KB of LodChunks block
+#define LOD_BINDING 2
+#define LOD_PIXEL_ERROR 0.5          // screen space error allowed (pixels)
+#define LOD_COLOR_ERROR (2.0 / 255)  // lit color interpolation error allowed
+#define LOD_MIN_SPACING 0.5f         // pixels between vertices, finer shading isn't seen
+
+typedef struct {
+  float x, z, size, morph;   // uChunks[] of the LodChunks block
+} LodChunk;
+
+struct {
+  LodChunk chunks[LOD_MAX_CHUNKS];
+  int count;                 // chunks of the view being drawn
+  GLuint buffer;             // LodChunks block, the chunks of the view
+  int level;
+  float morph;               // 0 at the level's own grid, 1 at its parent's
+} lod;
+
+// Patches per side of the tessellation shaders' grid, subdivided up to
+// gl_MaxTessGenLevel (at least 64, so tess 2048) times, see drawTessPatches()
+#define TESS_PATCHES 32
+// Patches per draw of the multi-draw, as llvmpipe garbles draws tessellated
+// into more vertices than 16 bits address (8 patches of 65^2 at most)
+#define TESS_BATCH 8
+#define TESS_DRAWS (TESS_PATCHES * TESS_PATCHES / TESS_BATCH)
+
+struct {
+  GLint firsts[TESS_DRAWS];
+  GLsizei counts[TESS_DRAWS];
+} tessBatches;
+
+// Runs of the visible tiles of the VBO mesh, see selectTileRuns()
+#define CULL_TILES 16          // per side
+
+struct {
+  GLsizei* counts;             // indices of each run
+  GLint* firsts;               // first index of each run
+  const void** offsets;        // its byte offset in the index buffer
+  int runs, capacity;
+  int drawn, culled;           // tiles of the frame's draws, 0 when none was culled
+} tiles;
+
+// Inputs the current VBO mesh was built from
+glm::mat4 meshView;
+float meshT;
 
 /* ########## DEBUGGING RELATED FUNCTIONS ########## */
 int err;
@@ -196,71 +428,898 @@ void printMatrixColumnMajor(float *m, int n)
   printf("\n");
 }
 
+/* ########## FRAME PRESENTATION ########## */
+void swapBuffers()
+{
+  // Headless (benchmark) rendering goes to an offscreen framebuffer, so
+  // finish the frame instead of swapping to make frame times comparable
+  profileBegin(p_swap);
+  if (g.headless)
+    glFinish();
+  else
+    glutSwapBuffers();
+  profileEnd(p_swap);
+}
+
+// The sines of wave dimensions 2 and 3, A1 sin(k1 x + w1 t) + A2 sin(k2 z + w2 t),
+// defined for the shaders by initShaderCommon()
+const float A1 = 0.25, k1 = 2.0 * M_PI, w1 = 0.25;
+const float A2 = 0.25, k2 = 2.0 * M_PI, w2 = 0.25;
+
+// uDimension of the shaders, 0 for the (flat) grid
+int waveDimension()
+{
+  return g.wave ? g.waveDim : 0;
+}
+
+/* ########## OCEAN ########## */
+/* Wave dimension 5 is Tessendorf's FFT ocean (see ocean.h). Its maps of the
+ * height and slopes are remade once per frame time by an inverse FFT over
+ * g.oceanSize^2 frequencies, the passes of the transform split over the
+ * worker threads, so the whole ocean costs O(N log N) however many vertices
+ * there are, where the spectrum costs O(vertices x waves). The CPU samples the
+ * maps for the mesh (see waveVertices()); for the shaders they are uploaded
+ * to a float texture, uHeightmap, that heightmapVertex() fetches from. */
+#define HEIGHTMAP_UNIT 1
+
+static struct {
+  Ocean ocean;
+  int size;         // g.oceanSize the ocean was made for, 0 before the first
+  GLuint texture;   // uHeightmap
+  int textureSize;
+  float uploaded;   // time of the texture's texels, -1 before the first
+} ocean;
+
+// The ocean of g.oceanSize at time g.t
+const Ocean* currentOcean()
+{
+  if (ocean.size != g.oceanSize) {
+    if (ocean.size)
+      freeOcean(&ocean.ocean);
+    makeOcean(&ocean.ocean, g.oceanSize, 0.25, 1.0);
+    ocean.size = g.oceanSize;
+    ocean.uploaded = -1.0;
+  }
+  if (ocean.ocean.t != g.t) {
+    profileBegin(p_ocean);
+    updateOcean(&ocean.ocean, g.t, parallelFor);
+    profileEnd(p_ocean);
+  }
+  return &ocean.ocean;
+}
+
+// Bring the uHeightmap texture up to date with the ocean and bind it
+void updateHeightmapTexture()
+{
+  const Ocean* o = currentOcean();
+
+  if (ocean.textureSize != o->size || ocean.uploaded != o->t) {
+    if (!ocean.texture)
+      glGenTextures(1, &ocean.texture);
+    stateActiveTexture(GL_TEXTURE0 + HEIGHTMAP_UNIT);
+    stateBindTexture(GL_TEXTURE_2D, ocean.texture);
+  }
+  if (ocean.textureSize != o->size) {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, o->size, o->size, 0, GL_RGB, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    ocean.textureSize = o->size;
+    ocean.uploaded = -1.0;
+  }
+  if (ocean.uploaded != o->t) {
+    profileBegin(p_ocean);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, o->size, o->size, GL_RGB, GL_FLOAT, o->texels);
+    profileEnd(p_ocean);
+    ocean.uploaded = o->t;
+  }
+  // Unit 0 stays active for the fixed pipeline and the OSD
+  stateActiveTexture(GL_TEXTURE0);
+  stateBindTextureUnit(HEIGHTMAP_UNIT, ocean.texture);
+}
+
+void releaseHeightmapTexture()
+{
+  stateDeleteTextures(1, &ocean.texture);
+  ocean.texture = 0;
+  ocean.textureSize = 0;
+}
+
+/* ########## WAVE SPECTRUM ########## */
+/* Wave dimension 4 is a spectrum of g.waves directional Gerstner waves (see
+ * spectrum.h) in place of the sines. It isn't separable, so the CPU evaluates
+ * it per vertex, a chunk of a row at a time through evaluateSpectrumSoA() (see
+ * waveVertices()), and the shaders' spectrumVertex() does the same from the
+ * WaveSpectrum uniform block, which holds the same waves. */
+#define SPECTRUM_BINDING 1
+
+// WaveSpectrum as laid out by std140
+typedef struct {
+  GLfloat waves[2 * SPECTRUM_MAX_WAVES][4];  // (dirX, dirZ, k, A) and (speed, phase, Q, 0) per wave
+  GLfloat bounds[4];                         // amplitude, reach, curvature, curvature rate
+  GLint count;
+} SpectrumBlock;
+
+// Offsets std140 gives the members of the block in common.glsl
+static_assert(offsetof(SpectrumBlock, bounds) == 32 * SPECTRUM_MAX_WAVES, "SpectrumBlock layout");
+static_assert(offsetof(SpectrumBlock, count) == 32 * SPECTRUM_MAX_WAVES + 16, "SpectrumBlock layout");
+
+static struct {
+  WaveSpectrum waves;
+  int count;          // g.waves the waves were made for, 0 before the first
+  GLuint buffer;      // WaveSpectrum block
+  int uploaded;       // count of the buffer's waves, 0 before the first
+  GLfloat bounds[4];  // the buffer's wave bounds
+} spectrum;
+
+// The spectrum of g.waves waves
+const WaveSpectrum* currentSpectrum()
+{
+  if (spectrum.count != g.waves) {
+    makeSpectrum(&spectrum.waves, g.waves, 0.25, 1.0);
+    spectrum.count = g.waves;
+  }
+  return &spectrum.waves;
+}
+
+/* Bounds of the wave of a dimension, 0 for the grid: how far it can be from
+ * the grid up and down (amplitude) and sideways (reach), of its curvature and
+ * of the curvature's rate of change */
+void waveBounds(int dimension, float & amplitude, float & reach, float & curvature, float & curvatureRate)
+{
+  amplitude = reach = curvature = curvatureRate = 0.0;
+  if (dimension == 4) {
+    spectrumBounds(currentSpectrum(), &amplitude, &reach, &curvature, &curvatureRate);
+    return;
+  }
+  if (dimension == 5) {
+    oceanBounds(currentOcean(), &amplitude, &curvature, &curvatureRate);
+    return;
+  }
+  if (dimension) {
+    curvature = A1 * k1 * k1;
+    curvatureRate = A1 * k1 * k1 * k1;
+    amplitude = A1;
+  }
+  if (dimension == 3) {
+    curvature += A2 * k2 * k2;
+    curvatureRate += A2 * k2 * k2 * k2;
+    amplitude += A2;
+  }
+}
+
+// Bounds of the current wave for the frame being drawn: amplitude, reach,
+// curvature and its rate of change
+static GLfloat frameBounds[4];
+
+/* The current wave's bounds, once per frame ahead of its draws rather than per
+ * view or program (the spectrum's are summed over its waves) */
+void updateWaveBounds()
+{
+  waveBounds(waveDimension(), frameBounds[0], frameBounds[1], frameBounds[2], frameBounds[3]);
+}
+
+/* Bring the WaveSpectrum block up to date with the spectrum, and its bounds
+ * with those of the frame, and bind it */
+void updateSpectrumBlock()
+{
+  const WaveSpectrum* s = currentSpectrum();
+
+  if (!spectrum.buffer) {
+    glGenBuffers(1, &spectrum.buffer);
+    stateBindBuffer(GL_UNIFORM_BUFFER, spectrum.buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(SpectrumBlock), NULL, GL_STATIC_DRAW);
+  }
+  if (spectrum.uploaded != spectrum.count) {
+    SpectrumBlock b;
+    memset(&b, 0, sizeof b);
+    for (int i = 0; i < s->count; i++) {
+      const GerstnerWave & w = s->waves[i];
+      GLfloat wave[8] = { w.dirX, w.dirZ, w.k, w.amplitude, w.speed, w.phase, w.steepness, 0.0 };
+      memcpy(b.waves[2 * i], wave, sizeof wave);
+    }
+    memcpy(b.bounds, frameBounds, sizeof frameBounds);
+    b.count = s->count;
+    stateBindBuffer(GL_UNIFORM_BUFFER, spectrum.buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof b, &b);
+    spectrum.uploaded = spectrum.count;
+    memcpy(spectrum.bounds, frameBounds, sizeof frameBounds);
+  }
+  // The ocean's change every frame
+  if (memcmp(frameBounds, spectrum.bounds, sizeof frameBounds) != 0) {
+    stateBindBuffer(GL_UNIFORM_BUFFER, spectrum.buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, offsetof(SpectrumBlock, bounds), sizeof frameBounds, frameBounds);
+    memcpy(spectrum.bounds, frameBounds, sizeof frameBounds);
+  }
+  stateBindBufferRange(GL_UNIFORM_BUFFER, SPECTRUM_BINDING, spectrum.buffer, 0, sizeof(SpectrumBlock));
+}
+
+void releaseSpectrumBlock()
+{
+  stateDeleteBuffers(1, &spectrum.buffer);
+  spectrum.buffer = 0;
+  spectrum.uploaded = 0;
+}
+
+/* ########## HEIGHTMAP ########## */
+/* With heightmap on, the shaders don't evaluate the wave per vertex. Once per
+ * frame time heightmap.frag bakes it, its height and analytic slopes, into a
+ * float texture of g.heightmapSize + 1 texels a side through a framebuffer,
+ * and every program reads that as it reads the ocean's maps (uDimension 5):
+ * vertices fetch their height and normal, per pixel lighting the normal. The
+ * wave costs the same whatever g.tess is, and the mesh, its normals and all
+ * the views of the multiview share the one bake. The spectrum's grid points
+ * are moved sideways, so heightmap.frag finds the point landing on each texel,
+ * and the static grid is only moved up and down. */
+#define HEIGHTMAP_MIN_SIZE 16    // g.heightmapSize
+#define HEIGHTMAP_MAX_SIZE 2048
+
+static struct {
+  GLuint texture, fbo;
+  int size;         // texels a side, 0 before the first bake
+  int dimension;    // g.waveDim, g.waves and time of the baked wave
+  int waves;
+  float t;
+} heightmap;
+
+/* The shaders read the wave from the baked heightmap. Not when lit on the CPU,
+ * which evaluates the wave per vertex for the colors anyway */
+bool bakedHeightmap()
+{
+  return g.heightmap && heightmapProgram && g.useShaders && g.wave && g.waveDim < 5 &&
+    !(g.lighting && !g.fixed);
+}
+
+// uDimension of the shaders, 5 when they read the wave's heightmap
+int shaderDimension()
+{
+  return bakedHeightmap() ? 5 : waveDimension();
+}
+
+// uHeightmapSpan, the texels of uHeightmap from -1 to 1: the ocean's maps
+// repeat after their size, the baked wave's (a texel larger) end on a texel at 1
+int heightmapSpan()
+{
+  return bakedHeightmap() ? g.heightmapSize : g.oceanSize;
+}
+
+/* Bake the wave at g.t into the heightmap, unless it is already there. Called
+ * ahead of the frame's draws, it leaves the framebuffer and viewport as found */
+void bakeHeightmap()
+{
+  int size = g.heightmapSize + 1;
+  GLuint framebuffer;
+  GLint viewport[4];
+
+  if (!bakedHeightmap() || (heightmap.size == size && heightmap.dimension == g.waveDim &&
+      heightmap.waves == g.waves && heightmap.t == g.t))
+    return;
+
+  profileBegin(p_bake);
+  framebuffer = stateGetDrawFramebuffer();
+  stateGetViewport(viewport);
+  if (heightmap.size != size) {
+    if (!heightmap.texture) {
+      glGenTextures(1, &heightmap.texture);
+      glGenFramebuffers(1, &heightmap.fbo);
+    }
+    // The last texels are at 1, where the wave needn't repeat
+    stateActiveTexture(GL_TEXTURE0 + HEIGHTMAP_UNIT);
+    stateBindTexture(GL_TEXTURE_2D, heightmap.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size, size, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    stateActiveTexture(GL_TEXTURE0);
+    stateBindFramebuffer(GL_DRAW_FRAMEBUFFER, heightmap.fbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, heightmap.texture, 0);
+    heightmap.size = size;
+  }
+  else
+    stateBindFramebuffer(GL_DRAW_FRAMEBUFFER, heightmap.fbo);
+
+  // A triangle over the framebuffer, a texel per fragment
+  if (g.waveDim == 4)
+    updateSpectrumBlock();
+  stateViewport(0, 0, size, size);
+  statePolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  stateUseProgram(heightmapProgram);
+  glUniform1i(heightmapUniforms.dimension, g.waveDim);
+  glUniform1f(heightmapUniforms.time, g.t);
+  glUniform1i(heightmapUniforms.size, size);
+  bindEmptyVertexArray();
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  stateBindVertexArray(0);
+  stateUseProgram(0);
+
+  stateBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+  stateViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  heightmap.dimension = g.waveDim;
+  heightmap.waves = g.waves;
+  heightmap.t = g.t;
+  profileEnd(p_bake);
+}
+
+// Bind uHeightmap, the baked wave's or the ocean's maps
+void bindHeightmap()
+{
+  if (!bakedHeightmap()) {
+    updateHeightmapTexture();
+    return;
+  }
+  stateBindTextureUnit(HEIGHTMAP_UNIT, heightmap.texture);
+}
+
+void releaseHeightmap()
+{
+  stateDeleteFramebuffers(1, &heightmap.fbo);
+  stateDeleteTextures(1, &heightmap.texture);
+  heightmap.fbo = heightmap.texture = 0;
+  heightmap.size = 0;
+}
+
 /* ########## ENABLING SHADER PROGRAM ########## */
+/* What the programs share (matrices, shininess, time, the flags) is the
+ * std140 uniform block ShadingState, read from one buffer, instead of a dozen
+ * uniforms set program by program on every draw. The buffer has a slot per
+ * view of the multiview, and one for the single pass multiview draw, each only
+ * written when its contents differ from the last written, so a still frame
+ * writes nothing and an animated one each slot once. */
+#define STATE_SLOTS (NUM_VIEWS + 1)
+#define STATE_MULTIVIEW NUM_VIEWS  // slot of the single pass multiview draw
+#define STATE_BINDING 0
+
+// ShadingState as laid out by std140, mat3 columns padded to vec4s
+typedef struct {
+  GLfloat modelViewMat[16], projectionMat[16];
+  GLfloat normalMat[12];
+  GLfloat shininess, time;
+  GLint tesselation, flat;
+  GLfloat viewMats[NUM_VIEWS][16];
+  GLfloat viewNormalMats[NUM_VIEWS][12];
+  GLfloat heightmapSpan;
+  GLint dimension, phong, pixel, positional, fixed, lighting;
+} ShadingState;
+
+// Offsets std140 gives the members of the block in common.glsl
+static_assert(offsetof(ShadingState, projectionMat) == 64, "ShadingState layout");
+static_assert(offsetof(ShadingState, normalMat) == 128, "ShadingState layout");
+static_assert(offsetof(ShadingState, shininess) == 176, "ShadingState layout");
+static_assert(offsetof(ShadingState, tesselation) == 184, "ShadingState layout");
+static_assert(offsetof(ShadingState, viewMats) == 192, "ShadingState layout");
+static_assert(offsetof(ShadingState, viewNormalMats) == 192 + 64 * NUM_VIEWS, "ShadingState layout");
+static_assert(offsetof(ShadingState, heightmapSpan) == 192 + 112 * NUM_VIEWS, "ShadingState layout");
+static_assert(offsetof(ShadingState, dimension) == 196 + 112 * NUM_VIEWS, "ShadingState layout");
+static_assert(sizeof(ShadingState) == 220 + 112 * NUM_VIEWS, "ShadingState layout");
+
+static struct {
+  GLuint buffer;
+  GLint stride;                      // slot size, a multiple of the offset alignment
+  ShadingState slots[STATE_SLOTS];   // contents of the buffer
+  bool written[STATE_SLOTS];
+  int slot;                          // slot of the view being drawn
+} shading;
+
+/* Nothing of the mesh comes from the CPU when it is drawn from VBOs with
+ * shaders (the wave, or the grid in the core profile) and its colors aren't
+ * lit on the CPU, so the vertex shaders can make it from gl_VertexID:
+ * - with lod, as the chunks of a quadtree, see selectLodChunks()
+ * - with tessShader, as a grid of patches the tessellation shaders subdivide
+ * - with vertexId, as one grid of g.tess from uTesselation, no vertex buffer */
+bool gpuMesh()
+{
+  return g.vbo && g.useShaders && (g.wave || g.core) && !(g.lighting && !g.fixed);
+}
+
+bool lodMesh()
+{
+  return g.lod && gpuMesh();
+}
+
+bool tessMesh()
+{
+  return g.tessShader && tessProgram && !g.lod && gpuMesh();
+}
+
+bool vertexIdMesh()
+{
+  return g.vertexId && !g.lod && !tessMesh() && gpuMesh();
+}
+
+void getUniforms(int program, Uniforms & u)
+{
+  GLuint block = glGetUniformBlockIndex(program, "ShadingState");
+  if (block != GL_INVALID_INDEX)
+    glUniformBlockBinding(program, block, STATE_BINDING);
+  block = glGetUniformBlockIndex(program, "WaveSpectrum");
+  if (block != GL_INVALID_INDEX)
+    glUniformBlockBinding(program, block, SPECTRUM_BINDING);
+  block = glGetUniformBlockIndex(program, "LodChunks");
+  if (block != GL_INVALID_INDEX)
+    glUniformBlockBinding(program, block, LOD_BINDING);
+  // Samplers are set on the program in use, the fixed pipeline's (0) is restored
+  GLint heightmap = glGetUniformLocation(program, "uHeightmap");
+  if (heightmap >= 0) {
+    stateUseProgram(program);
+    glUniform1i(heightmap, HEIGHTMAP_UNIT);
+    stateUseProgram(0);
+  }
+
+  // bools
+  u.lod = glGetUniformLocation(program, "uLod");
+
+  // floats
+  u.normalLength = glGetUniformLocation(program, "uNormalLength");
+
+  // vec4s
+  u.pixels = glGetUniformLocation(program, "uPixels");
+
+  // heightmap program's own
+  u.time = glGetUniformLocation(program, "uBakeTime");
+  u.dimension = glGetUniformLocation(program, "uBakeDimension");
+  u.size = glGetUniformLocation(program, "uBakeSize");
+}
+
+/* common.glsl goes in every shader, with the constants of the C code it needs
+ * defined ahead of it, floats printed so they read back the same */
+void initShaderCommon()
+{
+  char defines[512];
+
+  snprintf(defines, sizeof defines,
+    "#define NUM_VIEWS %d\n#define SPECTRUM_MAX_WAVES %d\n#define LOD_BATCH %d\n"
+    "#define A1 %#.9g\n#define k1 %#.9g\n#define w1 %#.9g\n"
+    "#define A2 %#.9g\n#define k2 %#.9g\n#define w2 %#.9g\n"
+    "#define LOD_PIXEL_ERROR %#.9g\n#define LOD_COLOR_ERROR %#.9g\n#define LOD_MIN_SPACING %#.9g\n",
+    NUM_VIEWS, SPECTRUM_MAX_WAVES, LOD_BATCH, A1, k1, w1, A2, k2, w2,
+    LOD_PIXEL_ERROR, LOD_COLOR_ERROR, LOD_MIN_SPACING);
+  setShaderCommon(defines, commonFile);
+}
+
+void initShadingState()
+{
+  GLint alignment = 1;
+
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  shading.stride = (sizeof(ShadingState) + alignment - 1) / alignment * alignment;
+  glGenBuffers(1, &shading.buffer);
+  stateBindBuffer(GL_UNIFORM_BUFFER, shading.buffer);
+  glBufferData(GL_UNIFORM_BUFFER, STATE_SLOTS * shading.stride, NULL, GL_DYNAMIC_DRAW);
+  memset(shading.written, 0, sizeof shading.written);
+  shading.slot = 0;
+}
+
+void releaseShadingState()
+{
+  stateDeleteBuffers(1, &shading.buffer);
+  shading.buffer = 0;
+  releaseSpectrumBlock();
+  stateDeleteBuffers(1, &lod.buffer);
+  lod.buffer = 0;
+  releaseHeightmapTexture();
+  releaseHeightmap();
+}
+
+void copyMat3(GLfloat* dst, const glm::mat3 & m)
+{
+  for (int c = 0; c < 3; c++) {
+    dst[4 * c] = m[c][0];
+    dst[4 * c + 1] = m[c][1];
+    dst[4 * c + 2] = m[c][2];
+    dst[4 * c + 3] = 0.0;
+  }
+}
+
+/* Bring the current slot up to date with the globals (for the single pass
+ * multiview draw, the views' matrices) and bind it for the programs */
+void setShadingState(int views = 0, glm::mat4* viewMats = NULL, glm::mat3* viewNormalMats = NULL)
+{
+  int slot = views ? STATE_MULTIVIEW : shading.slot;
+  ShadingState s;
+
+  memset(&s, 0, sizeof s);
+  memcpy(s.modelViewMat, &modelViewMatrix[0][0], sizeof s.modelViewMat);
+  memcpy(s.projectionMat, &projectionMatrix[0][0], sizeof s.projectionMat);
+  copyMat3(s.normalMat, normalMatrix);
+  s.shininess = g.shininess;
+  s.time = g.t;
+  s.tesselation = lodMesh() ? LOD_CHUNK : tessMesh() ? TESS_PATCHES : vertexIdMesh() ? g.tess : 0;
+  s.flat = g.flat;
+  for (int v = 0; v < views; v++) {
+    memcpy(s.viewMats[v], &viewMats[v][0][0], sizeof s.viewMats[v]);
+    copyMat3(s.viewNormalMats[v], viewNormalMats[v]);
+  }
+  s.dimension = shaderDimension();
+  if (s.dimension == 5)
+    s.heightmapSpan = heightmapSpan();
+  s.phong = g.phong;
+  s.pixel = g.perPixel;
+  s.positional = g.positional;
+  s.fixed = g.fixed;
+  s.lighting = g.lighting;
+
+  if (!shading.written[slot] || memcmp(&s, &shading.slots[slot], sizeof s) != 0) {
+    shading.slots[slot] = s;
+    shading.written[slot] = true;
+    stateBindBuffer(GL_UNIFORM_BUFFER, shading.buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, slot * shading.stride, sizeof s, &s);
+  }
+  stateBindBufferRange(GL_UNIFORM_BUFFER, STATE_BINDING, shading.buffer, slot * shading.stride, sizeof s);
+  updateSpectrumBlock();
+  if (s.dimension == 5)
+    bindHeightmap();
+}
+
+/* ########## SHADER PERMUTATIONS ########## */
+/* The lighting shaders are compiled once per combination of the flags they
+ * branch on, which become constants (PERMUTATION), so the branches and the
+ * lighting code a combination doesn't use are removed by the compiler rather
+ * than evaluated per vertex and pixel. Variants are compiled on first use.
+ * Flags that make no difference given the others (everything but positional,
+ * written to alpha, when unlit; the GPU lighting flags when lit on the CPU)
+ * are left out of the key, so fewer variants are needed. */
+#define VARIANT_KEYS 160  // 5 dimensions (grid, 2D, 3D, spectrum, ocean) x 5 flags
+
+typedef struct {
+  int program;  // 0 until compiled, -1 if compiling failed
+  Uniforms u;
+} ShaderVariant;
+
+ShaderVariant shadingVariants[VARIANT_KEYS], multiViewVariants[VARIANT_KEYS];
+
+// The #defines of a variant key's flags
+void variantDefines(int key, char* defines, size_t size)
+{
+  int dimension = key >> 5 ? (key >> 5) + 1 : 0;
+  const char* flags[5];
+
+  for (int i = 0; i < 5; i++)
+    flags[i] = key & (16 >> i) ? "true" : "false";
+  snprintf(defines, size, "#define PERMUTATION\n#define DIMENSION %d\n"
+    "#define LIGHTING %s\n#define FIXED %s\n#define PHONG %s\n#define PIXEL %s\n#define POSITIONAL %s\n",
+    dimension, flags[0], flags[1], flags[2], flags[3], flags[4]);
+}
+
+/* The variant of vertexFile/fragmentFile for the current flags, NULL if the
+ * uniform branching program has to be used instead */
+ShaderVariant* shaderVariant(ShaderVariant* variants, const char* vertexFile, const char* fragmentFile)
+{
+  bool lighting = g.lighting;
+  bool fixed = lighting && g.fixed;
+  bool phong = fixed && g.phong;
+  bool pixel = fixed && g.perPixel;
+  bool positional = g.positional;
+  int dimension = shaderDimension();
+  char defines[256];
+
+  if (g.uberShader)
+    return NULL;
+
+  int key = (dimension ? dimension - 1 : 0) << 5 | lighting << 4 | fixed << 3 |
+    phong << 2 | pixel << 1 | positional;
+  ShaderVariant* v = &variants[key];
+  if (v->program == 0) {
+    variantDefines(key, defines, sizeof defines);
+    v->program = getShaderVariant(vertexFile, NULL, fragmentFile, defines);
+    if (v->program)
+      getUniforms(v->program, v->u);
+    else
+      v->program = -1;
+    if (debug[d_shaders])
+      printf("shader variant %s/%s %d: %s\n", vertexFile, fragmentFile, key,
+        v->program > 0 ? "compiled" : "failed");
+  }
+  return v->program > 0 ? v : NULL;
+}
+
+void releaseShaderVariants()
+{
+  for (int i = 0; i < VARIANT_KEYS; i++) {
+    if (shadingVariants[i].program > 0)
+      glDeleteProgram(shadingVariants[i].program);
+    if (multiViewVariants[i].program > 0)
+      glDeleteProgram(multiViewVariants[i].program);
+  }
+  memset(shadingVariants, 0, sizeof shadingVariants);
+  memset(multiViewVariants, 0, sizeof multiViewVariants);
+}
+
 void applyShading()
 {
-  // Define projection matrix
-  glm::mat4 projectionMatrix = glm::ortho(-1.0, 1.0, -1.0, 1.0, -100.0, 100.0);
+  // Not permuted, the tessellation shaders branch on the uniforms
+  if (tessMesh()) {
+    activeUniforms = &tessUniforms;
+    stateUseProgram(tessProgram);
+    setShadingState();
+    return;
+  }
+
+  ShaderVariant* v = shaderVariant(shadingVariants, g.core ? coreVertexFile : vertexFile,
+    g.core ? coreFragmentFile : fragmentFile);
 
   // Place program in use for shaders
-  glUseProgram(shaderProgram);
+  activeUniforms = v ? &v->u : &shaderUniforms;
+  stateUseProgram(v ? v->program : shaderProgram);
+  setShadingState();
+}
 
-  // Uniforms that can be passed into both shader.vert and shader.frag
-  // ints
-  glUniform1i(tesselationLoc, g.tess);
-  glUniform1i(dimensionLoc, g.waveDim);
-  // floats
-  glUniform1f(shineLoc, g.shininess);
-  glUniform1f(timeLoc, g.t);
-  // bools
-  glUniform1i(phongLoc, g.phong);
-  glUniform1i(pixelLoc, g.perPixel);
-  glUniform1i(positionalLoc, g.positional);
-  glUniform1i(fixedLoc, g.fixed);
-  glUniform1i(flatLoc, g.flat);
-  glUniform1i(lightingLoc, g.lighting);
-  // matricies
-  glUniformMatrix3fv(normalMatLoc, 1, false, &normalMatrix[0][0]);
-  glUniformMatrix4fv(modelViewMatLoc, 1, false, &modelViewMatrix[0][0]);
-  glUniformMatrix4fv(projectionMatLoc, 1, false, &projectionMatrix[0][0]);
+// As applyShading(), with the matrices of every view for multiview.vert
+void applyMultiViewShading(int views, glm::mat4* viewMats, glm::mat3* viewNormalMats)
+{
+  ShaderVariant* v = shaderVariant(multiViewVariants, multiViewVertexFile, fragmentFile);
+
+  activeUniforms = v ? &v->u : &multiViewUniforms;
+  stateUseProgram(v ? v->program : multiViewProgram);
+  setShadingState(views, viewMats, viewNormalMats);
+}
+
+/* ########## SHADER RELOAD ########## */
+/* The shader files are watched while running interactively. When one is saved
+ * every program is rebuilt with startShaderBuild() and polled from idle(), so
+ * frames go on being drawn with the old programs until the new ones have
+ * linked (in the background with GL_KHR_parallel_shader_compile), and a
+ * program that fails to build is kept. Programs of unchanged files come
+ * straight from the program cache. */
+#define RELOAD_PROGRAMS (5 + 2 * VARIANT_KEYS)
+#define RELOAD_CHECK_INTERVAL 0.25  // seconds between checks for changed files
+
+typedef struct {
+  int* program;  // replaced once the build has linked
+  Uniforms* u;
+  ShaderBuild build;
+  bool building;
+} ProgramReload;
+
+static struct {
+  ProgramReload programs[RELOAD_PROGRAMS];
+  int count, pending;
+  int rebuilt, failed;
+  float lastCheckT;
+} reload;
+
+void watchShaders()
+{
+  const char* files[] = {
+    vertexFile, fragmentFile, multiViewVertexFile,
+    normalsVertexFile, normalsGeometryFile, normalsFragmentFile,
+    tessVertexFile, tessControlFile, tessEvaluationFile,
+    coreVertexFile, coreFragmentFile, coreNormalsVertexFile, coreNormalsGeometryFile,
+    linesVertexFile, linesFragmentFile, heightmapVertexFile, heightmapFragmentFile, commonFile
+  };
+  int watched = 0;
+
+  for (size_t i = 0; i < sizeof files / sizeof files[0]; i++)
+    watched += watchFile(files[i]);
+  printf("shader reload: watching %d files (%s)\n", watched, watchMethod());
+}
+
+// Start rebuilding *program from its files, if it was built
+void reloadProgram(int* program, Uniforms* u, const char* vertexFile, const char* geometryFile,
+  const char* fragmentFile, const char* defines, const char* tessControlFile = NULL,
+  const char* tessEvaluationFile = NULL)
+{
+  ProgramReload* r = &reload.programs[reload.count];
+
+  if (*program <= 0)
+    return;
+  r->program = program;
+  r->u = u;
+  if (tessControlFile)
+    r->building = startTessShaderBuild(&r->build, vertexFile, tessControlFile, tessEvaluationFile,
+      fragmentFile, defines);
+  else
+    r->building = startShaderBuild(&r->build, vertexFile, geometryFile, fragmentFile, defines);
+  if (r->building) {
+    reload.count++;
+    reload.pending++;
+  }
+}
+
+void startShaderReload()
+{
+  char defines[256];
+
+  // Builds of the previous change are out of date
+  for (int i = 0; i < reload.count; i++)
+    if (reload.programs[i].building)
+      cancelShaderBuild(&reload.programs[i].build);
+  memset(&reload.programs, 0, sizeof reload.programs);
+  reload.count = reload.pending = reload.rebuilt = reload.failed = 0;
+
+  if (g.core) {
+    reloadProgram(&shaderProgram, &shaderUniforms, coreVertexFile, NULL, coreFragmentFile, NULL);
+    reloadProgram(&normalsProgram, &normalsUniforms, coreNormalsVertexFile, coreNormalsGeometryFile,
+      linesFragmentFile, NULL);
+    reloadProgram(&linesProgram, &linesUniforms, linesVertexFile, NULL, linesFragmentFile, NULL);
+  }
+  else {
+    reloadProgram(&shaderProgram, &shaderUniforms, vertexFile, NULL, fragmentFile, NULL);
+    reloadProgram(&multiViewProgram, &multiViewUniforms, multiViewVertexFile, NULL, fragmentFile, NULL);
+    reloadProgram(&normalsProgram, &normalsUniforms, normalsVertexFile, normalsGeometryFile,
+      normalsFragmentFile, NULL);
+    reloadProgram(&tessProgram, &tessUniforms, tessVertexFile, NULL, fragmentFile, NULL,
+      tessControlFile, tessEvaluationFile);
+  }
+  reloadProgram(&heightmapProgram, &heightmapUniforms, heightmapVertexFile, NULL, heightmapFragmentFile, NULL);
+
+  for (int key = 0; key < VARIANT_KEYS; key++) {
+    ShaderVariant* shading = &shadingVariants[key];
+    ShaderVariant* multiView = &multiViewVariants[key];
+
+    // Variants that failed are tried again when next used
+    if (shading->program < 0)
+      shading->program = 0;
+    if (multiView->program < 0)
+      multiView->program = 0;
+    variantDefines(key, defines, sizeof defines);
+    reloadProgram(&shading->program, &shading->u, g.core ? coreVertexFile : vertexFile, NULL,
+      g.core ? coreFragmentFile : fragmentFile, defines);
+    reloadProgram(&multiView->program, &multiView->u, multiViewVertexFile, NULL, fragmentFile, defines);
+  }
+  printf("shader reload: rebuilding %d programs\n", reload.pending);
+}
+
+// Called every frame, t in seconds
+void checkShaderReload(float t)
+{
+  if (t - reload.lastCheckT > RELOAD_CHECK_INTERVAL) {
+    reload.lastCheckT = t;
+    if (filesChanged())
+      startShaderReload();
+  }
+  if (!reload.pending)
+    return;
+
+  for (int i = 0; i < reload.count; i++) {
+    ProgramReload* r = &reload.programs[i];
+    if (!r->building || !shaderBuildDone(&r->build))
+      continue;
+    GLuint program = finishShaderBuild(&r->build);
+    r->building = false;
+    reload.pending--;
+    if (program) {
+      glDeleteProgram(*r->program);
+      *r->program = program;
+      getUniforms(program, *r->u);
+      reload.rebuilt++;
+    }
+    else
+      reload.failed++;
+  }
+  if (!reload.pending) {
+    printf("shader reload: %d rebuilt, %d failed (previous program kept)\n", reload.rebuilt, reload.failed);
+  }
 }
 
 /* ########## DEFAULT FUNCTIONS ########## */
-void init(void)
+bool hasExtension(const char* name)
 {
-  glClearColor(0.0, 0.0, 0.0, 1.0);
-  if (g.twoside)
-    glLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
-  glEnable(GL_DEPTH_TEST);
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++)
+    if (strcmp((const char*) glGetStringi(GL_EXTENSIONS, i), name) == 0)
+      return true;
+  return false;
+}
 
+/* Programs of the core profile renderer. There is no fixed pipeline to fall
+ * back on, so all of them are required */
+void initCore()
+{
+  shaderProgram = getShader(coreVertexFile, coreFragmentFile);
+  normalsProgram = getGeometryShader(coreNormalsVertexFile, coreNormalsGeometryFile, linesFragmentFile);
+  linesProgram = getShader(linesVertexFile, linesFragmentFile);
+  if (!shaderProgram || !normalsProgram || !linesProgram) {
+    printf("core profile: unable to build the #version 330 shaders\n");
+    exit(1);
+  }
+  getUniforms(shaderProgram, shaderUniforms);
+  getUniforms(normalsProgram, normalsUniforms);
+  getUniforms(linesProgram, linesUniforms);
+
+  // multiview.vert uses compatibility inputs, views are drawn one at a time
+  multiViewProgram = 0;
+  printf("core profile: %s, single pass multiview unsupported, osd unavailable (bitmap fonts)\n",
+    glGetString(GL_VERSION));
+}
+
+// Programs of the (default) compatibility profile renderer
+void initCompatibility()
+{
   // Define the shader program using the input files (predefined)
   shaderProgram = getShader(vertexFile, fragmentFile);
 
   // Obtain uniform variables from the shader program
-  // ints
-  tesselationLoc = glGetUniformLocation(shaderProgram, "uTesselation");
-  dimensionLoc = glGetUniformLocation(shaderProgram, "uDimension");
-  // floats
-  shineLoc = glGetUniformLocation(shaderProgram, "uShininess");
-  timeLoc = glGetUniformLocation(shaderProgram, "uTime");
-  // bools
-  phongLoc = glGetUniformLocation(shaderProgram, "uPhong");
-  pixelLoc = glGetUniformLocation(shaderProgram, "uPixel");
-  positionalLoc = glGetUniformLocation(shaderProgram, "uPositional");
-  fixedLoc = glGetUniformLocation(shaderProgram, "uFixed");
-  flatLoc = glGetUniformLocation(shaderProgram, "uFlat");
-  lightingLoc = glGetUniformLocation(shaderProgram, "uLighting");
-  // mats
-  normalMatLoc = glGetUniformLocation(shaderProgram, "uNormalMat");
-  modelViewMatLoc = glGetUniformLocation(shaderProgram, "uModelViewMat");
-  projectionMatLoc = glGetUniformLocation(shaderProgram, "uProjectionMat");
+  getUniforms(shaderProgram, shaderUniforms);
+
+  // Single pass multiview needs viewport arrays selected from the vertex shader
+  multiViewProgram = 0;
+  if (hasExtension("GL_ARB_shader_viewport_layer_array"))
+    multiViewProgram = getShader(multiViewVertexFile, fragmentFile);
+  if (multiViewProgram)
+    getUniforms(multiViewProgram, multiViewUniforms);
+  printf("single pass multiview: %s\n", multiViewProgram ? "supported" : "unsupported");
+
+  // Without geometry shaders normals are drawn line by line on the CPU
+  normalsProgram = getGeometryShader(normalsVertexFile, normalsGeometryFile, normalsFragmentFile);
+  if (normalsProgram)
+    getUniforms(normalsProgram, normalsUniforms);
+  printf("normals: %s\n", normalsProgram ? "geometry shader" : "cpu");
+
+  // Tessellation shaders are GL 4.0
+  GLint major = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  tessProgram = 0;
+  if (major >= 4 || hasExtension("GL_ARB_tessellation_shader"))
+    tessProgram = getTessShader(tessVertexFile, tessControlFile, tessEvaluationFile, fragmentFile);
+  if (tessProgram)
+    getUniforms(tessProgram, tessUniforms);
+  printf("tessellation shaders: %s\n", tessProgram ? "supported" : "unsupported");
+}
+
+/* name in the user's cache directory: $XDG_CACHE_HOME, ~/.cache without it,
+ * ./shadercache without either */
+const char* programCachePath(const char* name)
+{
+  static char path[256];
+  const char* xdg = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+
+  // Relative $XDG_CACHE_HOME is invalid and ignored, as the spec says
+  if (xdg && xdg[0] == '/')
+    snprintf(path, sizeof path, "%s/%s", xdg, name);
+  else if (home && home[0])
+    snprintf(path, sizeof path, "%s/.cache/%s", home, name);
+  else
+    snprintf(path, sizeof path, "./shadercache");
+  return path;
+}
+
+void init(void)
+{
+  glClearColor(0.0, 0.0, 0.0, 1.0);
+  if (g.twoside && !g.core)
+    stateLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
+  stateEnable(GL_DEPTH_TEST);
+
+  printf("cpu lighting: %s, spectrum: %s, ocean fft: %s, mesh threads: %d\n", lightingPath(),
+    spectrumPath(), oceanPath(), workerThreads());
+
+  profileInit(p_nstages, profileStageNames);
+
+  // Persistent mapped vertex stream when supported, otherwise orphaning
+  stream.persistent = hasExtension("GL_ARB_buffer_storage");
+  printf("vertex stream: %s\n", stream.persistent ? "persistent" : "orphaning");
+
+  const char* cachePath = programCacheDir ? programCachePath(programCacheDir) : NULL;
+  setProgramCache(cachePath);
+  initShaderCommon();
+  if (g.core)
+    initCore();
+  else
+    initCompatibility();
+  heightmapProgram = getShader(heightmapVertexFile, heightmapFragmentFile);
+  if (heightmapProgram)
+    getUniforms(heightmapProgram, heightmapUniforms);
+  printf("heightmap: %s\n", heightmapProgram ? "supported" : "unsupported");
+  initShadingState();
+
+  int hits, misses;
+  getProgramCacheStats(&hits, &misses);
+  if (cachePath)
+    printf("program cache: %s, %d loaded, %d compiled\n", cachePath, hits, misses);
 }
 
 void reshape(int w, int h)
 {
   g.width = w;
   g.height = h;
-  glViewport(0, 0, (GLsizei) w, (GLsizei) h);
+  stateViewport(0, 0, (GLsizei) w, (GLsizei) h);
+  // The core profile's shaders take the same projection as a uniform
+  if (g.core)
+    return;
   glMatrixMode(GL_PROJECTION);
   glLoadIdentity();
   glOrtho(-1.0, 1.0, -1.0, 1.0, -100.0, 100.0);
@@ -268,10 +1327,56 @@ void reshape(int w, int h)
   glLoadIdentity();
 }
 
+/* Core profile axes, the same lines kept in a buffer and transformed by
+ * lines330.vert rather than on the CPU */
+struct {
+  GLuint vao, buffer;
+  float length;
+} axes;
+
+void drawAxesCore(float length)
+{
+  if (!axes.vao || axes.length != length) {
+    Vertex v[6];
+    for (int i = 0; i < 6; i++) {
+      glm::vec3 axis(0.0);
+      axis[i / 2] = 1.0;
+      v[i].pos = (i % 2 ? length : -length) * axis;
+      v[i].normal = glm::vec3(0.0);
+      v[i].color = axis;
+    }
+
+    if (!axes.vao) {
+      glGenVertexArrays(1, &axes.vao);
+      glGenBuffers(1, &axes.buffer);
+    }
+    stateBindVertexArray(axes.vao);
+    stateBindBuffer(GL_ARRAY_BUFFER, axes.buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof v, v, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(a_position);
+    glEnableVertexAttribArray(a_color);
+    glVertexAttribPointer(a_position, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), BUFFER_OFFSET(0));
+    glVertexAttribPointer(a_color, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), BUFFER_OFFSET(sizeof(glm::vec3) + sizeof(glm::vec3)));
+    axes.length = length;
+  }
+
+  stateUseProgram(linesProgram);
+  setShadingState();
+  stateBindVertexArray(axes.vao);
+  glDrawArrays(GL_LINES, 0, 6);
+  stateUseProgram(0);
+}
+
 void drawAxes(float length)
 {
   glm::vec4 v;
 
+  profileBegin(p_axes);
+  if (g.core) {
+    drawAxesCore(length);
+    profileEnd(p_axes);
+    return;
+  }
   glPushAttrib(GL_CURRENT_BIT);
   glBegin(GL_LINES);
 
@@ -298,6 +1403,7 @@ void drawAxes(float length)
 
   glEnd();
   glPopAttrib();
+  profileEnd(p_axes);
 }
 
 void drawVector(glm::vec3 & o, glm::vec3 & v, float s,
@@ -324,6 +1430,9 @@ void consolePM()
     printf("FRAME\n"); //OSD option
     printf("frame rate (f/s):  %5.0f\n", g.frameRate);
     printf("frame time (ms/f): %5.0f\n", 1.0 / g.frameRate * 1000.0);
+    int issued, elided;
+    stateCounts(&issued, &elided);
+    printf("state calls/f: %d issued, %d elided\n", issued, elided);
   }
   else if (g.option == FLAGS) {
     printf("FLAGS\n"); //OSD option
@@ -332,167 +1441,284 @@ void consolePM()
     printf("console: %s\n", g.consolePM?"true":"false");
     printf("positional: %s\n", g.positional?"true":"false");
     printf("fixed: %s\n", g.fixed?"true":"false");
+    printf("single pass: %s\n", g.singlePass?"true":"false");
     printf("shaders: %s\n", g.useShaders?"true":"false");
     printf("lighting: %s\n", g.lighting?"true":"false");
     printf("phong: %s\n", g.phong?"true":"false");
     printf("normals: %s\n", g.drawNormals?"true":"false");
     printf("per pixel: %s\n", g.perPixel?"true":"false");
     printf("wave: %s\n", g.wave?"true":"false");
+    printf("strips: %s\n", g.strips?"true":"false");
     printf("vbo: %s\n", g.vbo?"true":"false");
     printf("multiview: %s\n", g.multiView?"true":"false");
     printf("wireframe: %s\n", g.wireframe?"true":"false");
+    printf("heightmap: %s\n", g.heightmap?"true":"false");
   }
   else if (g.option == VALUES) {
     printf("VALUES\n"); //OSD option
     printf("shininess: %.2f\n", g.shininess);
     printf("tesselation: %d\n", g.tess);
-    printf("dimension: %d\n", g.waveDim);
+    printf("dimension: %d%s\n", g.waveDim, g.waveDim == 4 ? " (spectrum)" :
+      g.waveDim == 5 ? " (ocean)" : "");
+  }
+  else if (g.option == PROFILE) {
+    printf("PROFILE\n"); //OSD option
+    printf("stage     cpu ms   gpu ms\n");
+    for (int i = 0; i < p_nstages; i++)
+      printf("%-8s %7.3f  %7.3f\n", profileStageNames[i], profileCpu[i], profileGpu[i]);
+    printf("trace (r): %s\n", profileTracing()?"recording":"off");
   }
 }
 
-// On screen display
-void displayOSD()
+/* ########## ON SCREEN DISPLAY ########## */
+/* OSD text is drawn from a glyph atlas, rasterized once from the GLUT bitmap
+ * font, as a single batch of textured quads in a buffer. The batch is only laid
+ * out again when the text may have changed (key press, stats update, resize),
+ * see osdChanged(), rather than formatting every line every frame. */
+#define OSD_FONT GLUT_BITMAP_9_BY_15
+#define GLYPH_FIRST 32         // printable ASCII
+#define GLYPH_COUNT 96
+#define GLYPH_COLUMNS 16
+#define GLYPH_W 16             // atlas cell, larger than the 9x15 glyphs to
+#define GLYPH_H 24             // allow for their origin (xorig/yorig)
+#define GLYPH_X 4              // raster position of the glyph in its cell
+#define GLYPH_Y 6
+#define OSD_MAX_CHARS 1024
+
+typedef struct {
+  float x, y, s, t;
+} GlyphVertex;
+
+struct {
+  GLuint atlas, buffer;
+  bool dirty;
+  GLint viewport[4];     // viewport the batch was laid out for
+  int chars;             // characters in the batch
+  GlyphVertex* verts;    // 4 per character, filled while laying out
+} osd = { 0, 0, true, { 0, 0, 0, 0 }, 0, NULL };
+
+void osdChanged()
 {
-  char buffer[30];
-  char *bufp;
-  int w, h;
+  osd.dirty = true;
+}
 
-  glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
-  glDisable(GL_DEPTH_TEST);
-  glDisable(GL_LIGHTING);
+void setGlyphVertex(GlyphVertex & v, float x, float y, float s, float t)
+{
+  v.x = x;
+  v.y = y;
+  v.s = s;
+  v.t = t;
+}
+
+// Render each glyph of OSD_FONT into its cell of the atlas texture
+void buildGlyphAtlas()
+{
+  int w = GLYPH_COLUMNS * GLYPH_W, h = GLYPH_COUNT / GLYPH_COLUMNS * GLYPH_H;
+  GLuint framebuffer, fbo;
+
+  glGenTextures(1, &osd.atlas);
+  stateBindTexture(GL_TEXTURE_2D, osd.atlas);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  stateBindTexture(GL_TEXTURE_2D, 0);
+
+  framebuffer = stateGetDrawFramebuffer();
+  glGenFramebuffers(1, &fbo);
+  stateBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, osd.atlas, 0);
+
+  glPushAttrib(GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT | GL_VIEWPORT_BIT);
+  glViewport(0, 0, w, h);
+  glClearColor(0.0, 0.0, 0.0, 0.0);
+  glClear(GL_COLOR_BUFFER_BIT);
 
   glMatrixMode(GL_PROJECTION);
   glPushMatrix();
   glLoadIdentity();
-
-  /* Set up orthographic coordinate system to match the window,
-     i.e. (0,0)-(w,h) */
-  w = glutGet(GLUT_WINDOW_WIDTH);
-  h = glutGet(GLUT_WINDOW_HEIGHT);
   glOrtho(0.0, w, 0.0, h, -1.0, 1.0);
-
   glMatrixMode(GL_MODELVIEW);
   glPushMatrix();
   glLoadIdentity();
 
-  glColor3f(1.0, 1.0, 0.0);
+  glColor3f(1.0, 1.0, 1.0);
+  for (int i = 0; i < GLYPH_COUNT; i++) {
+    glRasterPos2i(i % GLYPH_COLUMNS * GLYPH_W + GLYPH_X, i / GLYPH_COLUMNS * GLYPH_H + GLYPH_Y);
+    glutBitmapCharacter(OSD_FONT, GLYPH_FIRST + i);
+  }
+
+  glPopMatrix();  /* Pop modelview */
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();  /* Pop projection */
+  glMatrixMode(GL_MODELVIEW);
+  glPopAttrib();
+
+  stateBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  stateDeleteFramebuffers(1, &fbo);
+}
+
+/* Add a line of text to the batch at (x, y) in the (0,0)-(w,h) coordinates the
+ * OSD uses, placed within the viewport like glRasterPos2i() would, with the
+ * glyphs themselves unscaled like glutBitmapCharacter() */
+void osdText(int x, int y, const char* format, ...)
+{
+  char buffer[64];
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(buffer, sizeof buffer, format, args);
+  va_end(args);
+
+  float px = osd.viewport[0] + (float) x * osd.viewport[2] / g.width;
+  float py = osd.viewport[1] + (float) y * osd.viewport[3] / g.height;
+  float atlasW = GLYPH_COLUMNS * GLYPH_W, atlasH = GLYPH_COUNT / GLYPH_COLUMNS * GLYPH_H;
+
+  for (char* c = buffer; *c && osd.chars < OSD_MAX_CHARS; c++) {
+    int glyph = (unsigned char) *c - GLYPH_FIRST;
+    if (glyph < 0 || glyph >= GLYPH_COUNT)
+      glyph = '?' - GLYPH_FIRST;
+
+    // Whole pixels, like the glBitmap() raster position, so texels map 1:1
+    float x0 = floorf(px) - GLYPH_X, y0 = floorf(py) - GLYPH_Y;
+    float s0 = glyph % GLYPH_COLUMNS * GLYPH_W / atlasW, t0 = glyph / GLYPH_COLUMNS * GLYPH_H / atlasH;
+    float s1 = s0 + GLYPH_W / atlasW, t1 = t0 + GLYPH_H / atlasH;
+    GlyphVertex* v = &osd.verts[4 * osd.chars++];
+    setGlyphVertex(v[0], x0, y0, s0, t0);
+    setGlyphVertex(v[1], x0 + GLYPH_W, y0, s1, t0);
+    setGlyphVertex(v[2], x0 + GLYPH_W, y0 + GLYPH_H, s1, t1);
+    setGlyphVertex(v[3], x0, y0 + GLYPH_H, s0, t1);
+
+    px += glutBitmapWidth(OSD_FONT, *c);
+  }
+}
+
+// Lines of the current OSD page
+void layoutOSD()
+{
   if (g.option == FRAME) {
-    // OSD option
-    glRasterPos2i(10, 40);
-    snprintf(buffer, sizeof buffer, "FRAME (o)");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // Frame rate
-    glRasterPos2i(10, 25);
-    snprintf(buffer, sizeof buffer, "frame rate (f/s):  %5.0f", g.frameRate);
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // Frame time
-    glRasterPos2i(10, 10);
-    snprintf(buffer, sizeof buffer, "frame time (ms/f): %5.0f",
-      1.0 / g.frameRate * milli);
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
+    int issued, elided;
+    stateCounts(&issued, &elided);
+    osdText(10, 55, "FRAME (o)");
+    osdText(10, 40, "frame rate (f/s):  %5.0f", g.frameRate);
+    osdText(10, 25, "frame time (ms/f): %5.0f", 1.0 / g.frameRate * milli);
+    osdText(10, 10, "state calls/f: %d issued, %d elided", issued, elided);
   }
   else if (g.option == FLAGS) {
-    // OSD option
-    glRasterPos2i(10, 220);
-    snprintf(buffer, sizeof buffer, "FLAGS (o)");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // animation
-    glRasterPos2i(10, 205);
-    snprintf(buffer, sizeof buffer, "animation (a): %s", g.animate?"true":"false");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // shader type
-    glRasterPos2i(10, 190);
-    snprintf(buffer, sizeof buffer, "flat (b): %s", g.flat?"true":"false");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // console output
-    glRasterPos2i(10, 175);
-    snprintf(buffer, sizeof buffer, "console (c): %s", g.consolePM?"true":"false");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // light type
-    glRasterPos2i(10, 160);
-    snprintf(buffer, sizeof buffer, "positional (d): %s", g.positional?"true":"false");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // fixed
-    glRasterPos2i(10, 145);
-    snprintf(buffer, sizeof buffer, "fixed (f): %s", g.fixed?"true":"false");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // shaders
-    glRasterPos2i(10, 130);
-    snprintf(buffer, sizeof buffer, "shaders (g): %s", g.useShaders?"true":"false");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // lighting
-    glRasterPos2i(10, 115);
-    snprintf(buffer, sizeof buffer, "lighting (l): %s", g.lighting?"true":"false");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // lighting calculation method
-    glRasterPos2i(10, 100);
-    snprintf(buffer, sizeof buffer, "phong (m): %s", g.phong?"true":"false");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // normals
-    glRasterPos2i(10, 85);
-    snprintf(buffer, sizeof buffer, "normals (n): %s", g.drawNormals?"true":"false");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // lighting calculation type
-    glRasterPos2i(10, 70);
-    snprintf(buffer, sizeof buffer, "per pixel (p): %s", g.perPixel?"true":"false");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // shape
-    glRasterPos2i(10, 55);
-    snprintf(buffer, sizeof buffer, "wave (s): %s", g.wave?"true":"false");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // vbos
-    glRasterPos2i(10, 40);
-    snprintf(buffer, sizeof buffer, "vbo (v): %s", g.vbo?"true":"false");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // multiview
-    glRasterPos2i(10, 25);
-    snprintf(buffer, sizeof buffer, "multiview (4): %s", g.multiView?"true":"false");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // wireframe
-    glRasterPos2i(10, 10);
-    snprintf(buffer, sizeof buffer, "wireframe (w): %s", g.wireframe?"true":"false");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
+    osdText(10, 325, "FLAGS (o)");
+    osdText(10, 310, "heightmap (y): %s", g.heightmap?"true":"false");
+    osdText(10, 295, "cull (k): %s", g.cull?"true":"false");
+    osdText(10, 280, "tess shaders (e): %s", g.tessShader?"true":"false");
+    osdText(10, 265, "lod (q): %s", g.lod?"true":"false");
+    osdText(10, 250, "vertex id (x): %s", g.vertexId?"true":"false");
+    osdText(10, 235, "animation (a): %s", g.animate?"true":"false");
+    osdText(10, 220, "flat (b): %s", g.flat?"true":"false");
+    osdText(10, 205, "console (c): %s", g.consolePM?"true":"false");
+    osdText(10, 190, "positional (d): %s", g.positional?"true":"false");
+    osdText(10, 175, "fixed (f): %s", g.fixed?"true":"false");
+    osdText(10, 160, "single pass (i): %s", g.singlePass?"true":"false");
+    osdText(10, 145, "shaders (g): %s", g.useShaders?"true":"false");
+    osdText(10, 130, "lighting (l): %s", g.lighting?"true":"false");
+    osdText(10, 115, "phong (m): %s", g.phong?"true":"false");
+    osdText(10, 100, "normals (n): %s", g.drawNormals?"true":"false");
+    osdText(10, 85, "per pixel (p): %s", g.perPixel?"true":"false");
+    osdText(10, 70, "wave (s): %s", g.wave?"true":"false");
+    osdText(10, 55, "strips (t): %s", g.strips?"true":"false");
+    osdText(10, 40, "vbo (v): %s", g.vbo?"true":"false");
+    osdText(10, 25, "multiview (4): %s", g.multiView?"true":"false");
+    osdText(10, 10, "wireframe (w): %s", g.wireframe?"true":"false");
   }
   else if (g.option == VALUES) {
-    // OSD option
-    glRasterPos2i(10, 55);
-    snprintf(buffer, sizeof buffer, "VALUES (o)");
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // shininess
-    glRasterPos2i(10, 40);
-    snprintf(buffer, sizeof buffer, "shininess (H/h): %.2f", g.shininess);
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // tesselation
-    glRasterPos2i(10, 25);
-    snprintf(buffer, sizeof buffer, "tesselation (+/-): %d", g.tess);
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
-    // dimention
-    glRasterPos2i(10, 10);
-    snprintf(buffer, sizeof buffer, "dimension (z): %d", g.waveDim);
-    for (bufp = buffer; *bufp; bufp++)
-      glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
+    osdText(10, 100, "VALUES (o)");
+    osdText(10, 85, "heightmap: %d^2 texels%s", g.heightmapSize + 1, bakedHeightmap() ? "" : " (unused)");
+    if (tiles.drawn || tiles.culled)
+      osdText(10, 70, "tiles: %d drawn, %d culled", tiles.drawn, tiles.culled);
+    else
+      osdText(10, 70, "tiles: off");
+    osdText(10, 55, "lod: level %d, %d chunks, morph %.2f", lod.level, lod.count, lod.morph);
+    osdText(10, 40, "shininess (H/h): %.2f", g.shininess);
+    osdText(10, 25, "tesselation (+/-): %d", g.tess);
+    if (g.waveDim == 4)
+      osdText(10, 10, "dimension (z): spectrum of %d waves", g.waves);
+    else if (g.waveDim == 5)
+      osdText(10, 10, "dimension (z): ocean of %d^2 frequencies", g.oceanSize);
+    else
+      osdText(10, 10, "dimension (z): %d", g.waveDim);
   }
+  else if (g.option == PROFILE) {
+    osdText(10, 40 + 15 * p_nstages, "PROFILE (o)  cpu/gpu ms");
+    // per stage times, a negative gpu time when there are no timer queries
+    for (int i = 0; i < p_nstages; i++)
+      osdText(10, 25 + 15 * (p_nstages - i), "%-8s %6.2f %6.2f",
+        profileStageNames[i], profileCpu[i], profileGpu[i]);
+    osdText(10, 10, "trace (r): %s", profileTracing()?"recording":"off");
+  }
+}
+
+// On screen display
+void displayOSD()
+{
+  GLint viewport[4];
+
+  // The glyph atlas is drawn with GLUT bitmap fonts, which need glBitmap()
+  if (g.core)
+    return;
+
+  profileBegin(p_osd);
+  // State restored by glPopAttrib() is set directly, the state cache keeps
+  // what it will be restored to
+  glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT | GL_TEXTURE_BIT | GL_COLOR_BUFFER_BIT | GL_VIEWPORT_BIT);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_LIGHTING);
+
+  if (!osd.atlas) {
+    buildGlyphAtlas();
+    glGenBuffers(1, &osd.buffer);
+    osd.verts = (GlyphVertex*) calloc(4 * OSD_MAX_CHARS, sizeof(GlyphVertex));
+  }
+
+  stateBindBuffer(GL_ARRAY_BUFFER, osd.buffer);
+
+  // Lay the text out again only if it (or where it goes) may have changed
+  stateGetViewport(viewport);
+  if (osd.dirty || memcmp(viewport, osd.viewport, sizeof viewport) != 0) {
+    memcpy(osd.viewport, viewport, sizeof viewport);
+    osd.chars = 0;
+    layoutOSD();
+    glBufferData(GL_ARRAY_BUFFER, 4 * osd.chars * sizeof(GlyphVertex), osd.verts, GL_DYNAMIC_DRAW);
+    osd.dirty = false;
+  }
+
+  /* Set up orthographic coordinate system to match the window,
+     i.e. (0,0)-(w,h), glyphs are positioned in window coordinates */
+  glViewport(0, 0, g.width, g.height);
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glOrtho(0.0, g.width, 0.0, g.height, -1.0, 1.0);
+
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+
+  // Glyphs are opaque where the atlas has them, modulated to yellow
+  stateBindTexture(GL_TEXTURE_2D, osd.atlas);
+  glEnable(GL_TEXTURE_2D);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+  glEnable(GL_ALPHA_TEST);
+  glAlphaFunc(GL_GREATER, 0.5);
+  glColor3f(1.0, 1.0, 0.0);
+
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+  glDisableClientState(GL_NORMAL_ARRAY);
+  glDisableClientState(GL_COLOR_ARRAY);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glVertexPointer(2, GL_FLOAT, sizeof(GlyphVertex), BUFFER_OFFSET(0));
+  glTexCoordPointer(2, GL_FLOAT, sizeof(GlyphVertex), BUFFER_OFFSET(2 * sizeof(float)));
+  glDrawArrays(GL_QUADS, 0, 4 * osd.chars);
+  glPopClientAttrib();
+
+  stateBindTexture(GL_TEXTURE_2D, 0);
 
   glPopMatrix();  /* Pop modelview */
   glMatrixMode(GL_PROJECTION);
@@ -501,390 +1727,1064 @@ void displayOSD()
   glMatrixMode(GL_MODELVIEW);
 
   glPopAttrib();
+  profileEnd(p_osd);
+}
+
+/* ########## CPU LIGHTING ########## */
+// Vertices are lit in chunks, laid out as structure of arrays for lighting.c
+#define LIGHTING_CHUNK 256
+
+typedef struct {
+  float px[LIGHTING_CHUNK], py[LIGHTING_CHUNK], pz[LIGHTING_CHUNK];
+  float nx[LIGHTING_CHUNK], ny[LIGHTING_CHUNK], nz[LIGHTING_CHUNK];
+  float r[LIGHTING_CHUNK], g[LIGHTING_CHUNK], b[LIGHTING_CHUNK];
+} LightingChunk;
+
+void setLightingInput(LightingChunk & c, int k, glm::vec3 & rEC, glm::vec3 & nEC)
+{
+  c.px[k] = rEC.x;
+  c.py[k] = rEC.y;
+  c.pz[k] = rEC.z;
+  c.nx[k] = nEC.x;
+  c.ny[k] = nEC.y;
+  c.nz[k] = nEC.z;
 }
 
 /* Perform ADS - ambient, diffuse and specular - lighting calculation
- * in eye coordinates (EC).
+ * in eye coordinates (EC) for the first n vertices of a chunk, following
+ * the shininess, phong and positional flags like the shaders do.
  */
-glm::vec3 computeLighting(glm::vec3 & rEC, glm::vec3 & nEC)
+void computeLighting(LightingChunk & c, int n)
 {
+  LightingParams params = { g.shininess, g.phong, g.positional };
+
+  computeLightingSoA(&params, n, c.px, c.py, c.pz, c.nx, c.ny, c.nz, c.r, c.g, c.b);
+
   if (debug[d_computeLighting]) {
-    printf("rEC ");
-    printVec(&rEC[0], 3);
-    printf("nEC ");
-    printVec(&nEC[0], 3);
-  }
-
-  // Used to accumulate ambient, diffuse and specular contributions
-  // Note: it is a vec3 being constructed with a single value which
-  // is used for all 3 components
-  glm::vec3 color(0.0);
-
-  // Ambient contribution: A=La×Ma
-  // Default light ambient color and default ambient material color
-  // are both (0.2, 0.2, 0.2)
-  glm::vec3 La(0.2);
-  glm::vec3 Ma(0.2);
-  glm::vec3 ambient(La * Ma);
-  color += ambient;
-
-  // Light direction vector. Default for LIGHT0 is a directional light
-  // along z axis for all vertices, i.e. <0, 0, 1>
-  glm::vec3 lEC( 0.5, 0.5, 0.5 );
-
-  // Test if normal points towards light source, i.e. if polygon
-  // faces toward the light - if not then no diffuse or specular
-  // contribution
-  float dp = glm::dot(nEC, lEC);
-  if (dp > 0.0) {
-    // Calculate diffuse and specular contribution
-
-    // Lambert diffuse: D=Ld×Md×cosθ
-    // Ld: default diffuse light color for GL_LIGHT0 is white (1.0, 1.0, 1.0).
-    // Md: default diffuse material color is grey (0.8, 0.8, 0.8).
-    glm::vec3 Ld(0.0, 0.5, 0.5);
-    glm::vec3 Md(0.8);
-    // Need normalized normal to calculate cosθ,
-    // light vector <0, 0, 1> is already normalized
-    nEC = glm::normalize(nEC);
-    float NdotL = glm::dot(nEC, lEC);
-    glm::vec3 diffuse(Ld * Md * NdotL);
-    color += diffuse;
-
-    // Blinn-Phong specular: S=Ls×Ms×cosⁿα
-    // Ls: default specular light color for LIGHT0 is white (1.0, 1.0, 1.0)
-    // Ms: specular material color, also set to white (1.0, 1.0, 1.0),
-    // but default for fixed pipeline is black, which means can't see
-    // specular reflection. Need to set it to same value for fixed
-    // pipeline lighting otherwise will look different.
-    glm::vec3 Ls(0.8, 0.8, 0.8);
-    glm::vec3 Ms(1.0);
-    // Default viewer is at infinity along z axis <0, 0, 1> i.e. a
-    // non local viewer (see glLightModel and GL_LIGHT_MODEL_LOCAL_VIEWER)
-    glm::vec3 vEC(0.0, 0.0, 1.0);
-    // Blinn-Phong half vector (using a single capital letter for
-    // variable name!). Need normalized H (and nEC, above) to calculate cosα.
-    glm::vec3 H(lEC + vEC);
-    H = glm::normalize(H);
-    float NdotH = glm::dot(nEC, H);
-    if (NdotH < 0.0)
-      NdotH = 0.0;
-    glm::vec3 specular(Ls * Ms * powf(NdotH, g.shininess));
-    color += specular;
-  }
-
-  return color;
+    for (int k = 0; k < n; k++) {
+      printf("rEC %5.3f %5.3f %5.3f nEC %5.3f %5.3f %5.3f color %5.3f %5.3f %5.3f\n",
+        c.px[k], c.py[k], c.pz[k], c.nx[k], c.ny[k], c.nz[k], c.r[k], c.g[k], c.b[k]);
+    }
+  }
+}
+
+/* ########## SEPARABLE WAVE TABLES ########## */
+/* Both waves are separable, sin(k1*x + w1*t) only depends on the column and
+ * sin(k2*z + w2*t) only on the row, so the trig is evaluated once per
+ * column/row per frame (O(tess)) rather than per vertex (O(tess^2)). The
+ * spectrum isn't, only the grid coordinates are used for it. */
+typedef struct {
+  int tess;
+  float t;
+  bool valid;
+  float *x, *z;        // grid coordinate of each column/row
+  float *colY, *colN;  // A1 * sin(k1 * x + w1 * t), -A1 * k1 * cos(k1 * x + w1 * t)
+  float *rowY, *rowN;  // A2 * sin(k2 * z + w2 * t), -A2 * k2 * cos(k2 * z + w2 * t)
+} WaveTable;
+
+WaveTable waveTable = { 0, 0.0, false, NULL, NULL, NULL, NULL, NULL, NULL };
+
+void buildWaveTable(int tess, float t)
+{
+  float stepSize = 2.0 / tess;
+
+  // Made here rather than by the rows, which may be built in parallel
+  if (g.waveDim == 4)
+    currentSpectrum();
+  else if (g.waveDim == 5)
+    currentOcean();
+
+  // Shared by all draws in a frame (e.g. multiview) until tess or time change
+  if (waveTable.valid && waveTable.tess == tess && waveTable.t == t)
+    return;
+
+  if (!waveTable.valid || waveTable.tess != tess) {
+    free(waveTable.x);
+    free(waveTable.z);
+    free(waveTable.colY);
+    free(waveTable.colN);
+    free(waveTable.rowY);
+    free(waveTable.rowN);
+    waveTable.x = (float*) calloc(tess + 1, sizeof(float));
+    waveTable.z = (float*) calloc(tess + 1, sizeof(float));
+    waveTable.colY = (float*) calloc(tess + 1, sizeof(float));
+    waveTable.colN = (float*) calloc(tess + 1, sizeof(float));
+    waveTable.rowY = (float*) calloc(tess + 1, sizeof(float));
+    waveTable.rowN = (float*) calloc(tess + 1, sizeof(float));
+  }
+
+  for (int i = 0; i <= tess; i++) {
+    float x = -1.0 + i * stepSize;
+    waveTable.x[i] = x;
+    waveTable.colY[i] = A1 * sinf(k1 * x + w1 * t);
+    waveTable.colN[i] = - A1 * k1 * cosf(k1 * x + w1 * t);
+  }
+  for (int j = 0; j <= tess; j++) {
+    float z = -1.0 + j * stepSize;
+    waveTable.z[j] = z;
+    waveTable.rowY[j] = A2 * sinf(k2 * z + w2 * t);
+    waveTable.rowN[j] = - A2 * k2 * cosf(k2 * z + w2 * t);
+  }
+
+  waveTable.tess = tess;
+  waveTable.t = t;
+  waveTable.valid = true;
+}
+
+/* Position and (unnormalized) normal of grid point (i, j) on the current
+ * sine wave, using the tables from buildWaveTable() */
+void waveVertex(int i, int j, glm::vec3 & r, glm::vec3 & n)
+{
+  r.x = waveTable.x[i];
+  r.z = waveTable.z[j];
+  r.y = waveTable.colY[i];
+  n.x = waveTable.colN[i];
+  n.y = 1.0;
+  n.z = 0.0;
+  if (g.waveDim == 3) {
+    r.y += waveTable.rowY[j];
+    n.z = waveTable.rowN[j];
+  }
+}
+
+/* Positions and (unnormalized) normals of count (up to LIGHTING_CHUNK) grid
+ * points of row j from column i0 on the current wave, the spectrum's through
+ * its SIMD kernel, the ocean's from its maps */
+void waveVertices(int i0, int j, int count, glm::vec3* r, glm::vec3* n)
+{
+  float z[LIGHTING_CHUNK], px[LIGHTING_CHUNK], py[LIGHTING_CHUNK], pz[LIGHTING_CHUNK];
+  float nx[LIGHTING_CHUNK], ny[LIGHTING_CHUNK], nz[LIGHTING_CHUNK];
+
+  if (g.waveDim == 5) {
+    for (int k = 0; k < count; k++) {
+      float height, slopeX, slopeZ;
+      sampleOcean(&ocean.ocean, waveTable.x[i0 + k], waveTable.z[j], &height, &slopeX, &slopeZ);
+      r[k] = glm::vec3(waveTable.x[i0 + k], height, waveTable.z[j]);
+      n[k] = glm::vec3(-slopeX, 1.0, -slopeZ);
+    }
+    return;
+  }
+  if (g.waveDim != 4) {
+    for (int k = 0; k < count; k++)
+      waveVertex(i0 + k, j, r[k], n[k]);
+    return;
+  }
+
+  // The whole chunk, the row's z being the same for every point
+  std::fill(z, z + LIGHTING_CHUNK, waveTable.z[j]);
+  evaluateSpectrumSoA(&spectrum.waves, waveTable.t, count, waveTable.x + i0, z, px, py, pz, nx, ny, nz);
+  for (int k = 0; k < count; k++) {
+    r[k] = glm::vec3(px[k], py[k], pz[k]);
+    n[k] = glm::vec3(nx[k], ny[k], nz[k]);
+  }
+}
+
+/* ########## MESH ROWS ########## */
+/* Fill row j (tess + 1 vertices) of the grid or sine wave with what both
+ * immediate mode and VBOs draw: object coordinate positions/normals, the
+ * modelViewMatrix being applied at draw time (GL matrix stack or shader
+ * uniform), and colors lit on the CPU when fixed is off. Only those colors
+ * depend on the view, they are lit in eye coordinates a chunk of the row at
+ * a time through computeLighting(). */
+void gridRow(int tess, int j, Vertex* row)
+{
+  LightingChunk chunk;
+  bool cpuLit = g.lighting && !g.fixed;
+  float stepSize = 2.0 / tess;
+  glm::vec3 r, n(0.0, 1.0, 0.0), rEC, nEC;
+
+  nEC = normalMatrix * n;
+  for (int i0 = 0; i0 <= tess; i0 += LIGHTING_CHUNK) {
+    int count = std::min(LIGHTING_CHUNK, tess + 1 - i0);
+    for (int k = 0; k < count; k++) {
+      r.x = -1.0 + (i0 + k) * stepSize;
+      r.y = 0.0;
+      r.z = -1.0 + j * stepSize;
+
+      row[i0 + k].pos = r;
+      row[i0 + k].normal = n;
+      row[i0 + k].color = cyan;
+      if (cpuLit) {
+        rEC = glm::vec3(modelViewMatrix * glm::vec4(r, 1.0));
+        setLightingInput(chunk, k, rEC, nEC);
+      }
+    }
+
+    if (cpuLit) {
+      computeLighting(chunk, count);
+      for (int k = 0; k < count; k++)
+        row[i0 + k].color = glm::vec3(chunk.r[k], chunk.g[k], chunk.b[k]);
+    }
+  }
+}
+
+void waveRow(int tess, int j, Vertex* row)
+{
+  LightingChunk chunk;
+  bool cpuLit = g.lighting && !g.fixed;
+  glm::vec3 r[LIGHTING_CHUNK], n[LIGHTING_CHUNK], rEC, nEC;
+
+  for (int i0 = 0; i0 <= tess; i0 += LIGHTING_CHUNK) {
+    int count = std::min(LIGHTING_CHUNK, tess + 1 - i0);
+    // Only the grid is needed when the shaders calculate the wave (below)
+    if (g.useShaders && !cpuLit && (g.waveDim >= 4 || bakedHeightmap()))
+      for (int k = 0; k < count; k++) {
+        r[k] = glm::vec3(waveTable.x[i0 + k], 0.0, waveTable.z[j]);
+        n[k] = glm::vec3(0.0, 1.0, 0.0);
+      }
+    else
+      waveVertices(i0, j, count, r, n);
+
+    for (int k = 0; k < count; k++) {
+      n[k] = glm::normalize(n[k]);
+
+      /* The modelViewMatrix and normalMatrix are applied when drawing, they
+       * are only required here for lighting calculations (when fixed is off) */
+      if (cpuLit) {
+        rEC = glm::vec3(modelViewMatrix * glm::vec4(r[k], 1.0));
+        nEC = normalMatrix * n[k];
+        setLightingInput(chunk, k, rEC, nEC);
+      }
+      // With shaders, the wave is calculated in shader.vert from the grid point
+      if (g.useShaders)
+        r[k] = glm::vec3(waveTable.x[i0 + k], 0.0, waveTable.z[j]);
+      row[i0 + k].pos = r[k];
+      row[i0 + k].normal = n[k];
+      row[i0 + k].color = cyan;
+    }
+
+    if (cpuLit) {
+      computeLighting(chunk, count);
+      for (int k = 0; k < count; k++)
+        row[i0 + k].color = glm::vec3(chunk.r[k], chunk.g[k], chunk.b[k]);
+    }
+  }
+}
+
+// Immediate mode equivalent of drawVBOShape() for a single vertex
+void emitVertex(Vertex & v)
+{
+  if (g.lighting) {
+    if (g.fixed)
+      glNormal3fv(&v.normal[0]);
+    else
+      glColor3fv(&v.color[0]);
+  }
+  glVertex3fv(&v.pos[0]);
+}
+
+/* Draw the grid/wave in immediate mode as quad strips between consecutive
+ * rows, each row being built (and lit) once */
+void drawRows(int tess, void (*buildRow)(int, int, Vertex*))
+{
+  profileBegin(p_draw);
+  Vertex* row0 = (Vertex*) calloc(tess + 1, sizeof(Vertex));
+  Vertex* row1 = (Vertex*) calloc(tess + 1, sizeof(Vertex));
+
+  buildRow(tess, 0, row0);
+  for (int j = 0; j < tess; j++) {
+    buildRow(tess, j + 1, row1);
+    glBegin(GL_QUAD_STRIP);
+    for (int i = 0; i <= tess; i++) {
+      emitVertex(row0[i]);
+      emitVertex(row1[i]);
+    }
+    glEnd();
+    std::swap(row0, row1);
+  }
+
+  free(row0);
+  free(row1);
+  profileEnd(p_draw);
+}
+
+/* ########## QUADTREE LOD ########## */
+/* With lod on, the mesh is the chunks of a quadtree over the [-1,1] square,
+ * each a LOD_CHUNK grid that the shaders place from gl_VertexID and their
+ * instance's chunk in the LodChunks block, rather than one grid of g.tess.
+ * A node is split while the screen space error
+ * of its grid, the wave's curvature (A*k^2, see waveBounds()) times the square of the grid
+ * spacing over 8 in pixels, is above LOD_PIXEL_ERROR, or when lit, the error
+ * of the colors (or normals) interpolated between its vertices is above
+ * LOD_COLOR_ERROR while they are more than LOD_MIN_SPACING pixels apart. Nodes are skipped
+ * with all of their children when their bounding box is outside the view. The projection
+ * being orthographic and the curvature bound the same everywhere, the error
+ * doesn't depend on where a node is, so the visible chunks of a view share a
+ * level and meet without cracks. The level wanted is fractional: its fraction
+ * morphs the chunks to their parent's grid, so zooming in or out (scale)
+ * changes level without popping. */
+// False if the box is entirely outside the clip volume of mvp
+bool boxInView(const glm::mat4 & mvp, const glm::vec3 & lo, const glm::vec3 & hi)
+{
+  int outside[6] = { 0, 0, 0, 0, 0, 0 };
+
+  for (int c = 0; c < 8; c++) {
+    glm::vec4 p = mvp * glm::vec4(c & 1 ? hi.x : lo.x, c & 2 ? hi.y : lo.y, c & 4 ? hi.z : lo.z, 1.0);
+    outside[0] += p.x < -p.w;
+    outside[1] += p.x > p.w;
+    outside[2] += p.y < -p.w;
+    outside[3] += p.y > p.w;
+    outside[4] += p.z < -p.w;
+    outside[5] += p.z > p.w;
+  }
+  for (int i = 0; i < 6; i++)
+    if (outside[i] == 8)
+      return false;
+  return true;
+}
+
+// Pixels per unit: the modelview's scale, the projection's [-1,1] filling the viewport
+float pixelsPerUnit()
+{
+  GLint viewport[4];
+
+  stateGetViewport(viewport);
+  return glm::length(glm::vec3(modelViewMatrix[0])) * std::max(viewport[2], viewport[3]) / 2.0;
+}
+
+void selectLodNode(const glm::mat4 & mvp, float amplitude, float reach, float x, float z, float size, int level)
+{
+  if (!boxInView(mvp, glm::vec3(x - reach, -amplitude, z - reach),
+      glm::vec3(x + size + reach, amplitude, z + size + reach)))
+    return;
+
+  if (level < lod.level) {
+    float half = size / 2.0;
+    selectLodNode(mvp, amplitude, reach, x, z, half, level + 1);
+    selectLodNode(mvp, amplitude, reach, x + half, z, half, level + 1);
+    selectLodNode(mvp, amplitude, reach, x, z + half, half, level + 1);
+    selectLodNode(mvp, amplitude, reach, x + half, z + half, half, level + 1);
+    return;
+  }
+
+  LodChunk & c = lod.chunks[lod.count++];
+  c.x = x;
+  c.z = z;
+  c.size = size;
+  c.morph = lod.morph;
+}
+
+// Chunks of the current view (modelViewMatrix and viewport)
+void selectLodChunks()
+{
+  float amplitude = frameBounds[0], reach = frameBounds[1];
+  float curvature = frameBounds[2], curvatureRate = frameBounds[3], wanted = 0.0;
+  float pixels = pixelsPerUnit();
+
+  /* Grid spacing meeting the errors, and the level it is found at (spacing
+   * 2 / (LOD_CHUNK << level)). The second derivative of the lit color is
+   * about shininess * curvature^2 (specular) + A*k^3 (the normal's) */
+  if (curvature > 0.0) {
+    float spacing = sqrtf(8.0 * LOD_PIXEL_ERROR / (curvature * pixels));
+    if (g.lighting) {
+      float shading = sqrtf(8.0 * LOD_COLOR_ERROR / (g.shininess * curvature * curvature + curvatureRate));
+      spacing = std::min(spacing, std::max(shading, LOD_MIN_SPACING / pixels));
+    }
+    // The maps are bilinear between their texels, a finer grid adds nothing
+    if (shaderDimension() == 5)
+      spacing = std::max(spacing, 2.0f / heightmapSpan());
+    wanted = log2f(2.0 / LOD_CHUNK / spacing);
+  }
+  lod.level = std::min(std::max((int) ceilf(wanted), 0), LOD_LEVELS - 1);
+  lod.morph = lod.level ? std::min(std::max(lod.level - wanted, 0.0f), 1.0f) : 0.0;
+
+  lod.count = 0;
+  selectLodNode(projectionMatrix * modelViewMatrix, amplitude, reach, -1.0, -1.0, 2.0, 0);
+}
+
+/* ########## TILE CULLING ########## */
+/* Zoomed in (camera.scale), most of the VBO mesh is outside the view. The mesh
+ * is split into CULL_TILES x CULL_TILES tiles, each bounded by a box as high as
+ * the wave's amplitude and widened by its reach (see waveBounds()), and the
+ * tiles outside the view (boxInView()) are left out of the draw. A row of the
+ * mesh across a run of visible tiles is a run of its indices, runs that follow
+ * each other in the index buffer (whole rows visible) are merged into one, and
+ * the runs are drawn by a single glMultiDrawElements (glMultiDrawArrays for
+ * the gl_VertexID mesh). */
+void addTileRun(size_t first, size_t count, bool strips)
+{
+  // Contiguous with the last run, or but for a strip's restart index
+  if (tiles.runs) {
+    size_t end = tiles.firsts[tiles.runs - 1] + tiles.counts[tiles.runs - 1];
+    if (first == end || (strips && first == end + 1)) {
+      tiles.counts[tiles.runs - 1] += first + count - end;
+      return;
+    }
+  }
+  if (tiles.runs == tiles.capacity) {
+    tiles.capacity = tiles.capacity ? 2 * tiles.capacity : 1024;
+    tiles.counts = (GLsizei*) realloc(tiles.counts, tiles.capacity * sizeof *tiles.counts);
+    tiles.firsts = (GLint*) realloc(tiles.firsts, tiles.capacity * sizeof *tiles.firsts);
+    tiles.offsets = (const void**) realloc(tiles.offsets, tiles.capacity * sizeof *tiles.offsets);
+  }
+  tiles.firsts[tiles.runs] = first;
+  tiles.counts[tiles.runs] = count;
+  tiles.runs++;
+}
+
+/* Runs of the index buffer of a tess grid (rowIndices per row) in the
+ * visible tiles of the current view (modelViewMatrix), with their byte
+ * offsets for indices of indexSize bytes */
+void selectTileRuns(int tess, bool strips, size_t rowIndices, size_t indexSize)
+{
+  float amplitude = frameBounds[0], reach = frameBounds[1];
+  int tileQuads = (tess + CULL_TILES - 1) / CULL_TILES;
+  int tileCount = (tess + tileQuads - 1) / tileQuads;
+  float stepSize = 2.0 / tess;
+  glm::mat4 mvp = projectionMatrix * modelViewMatrix;
+  bool visible[CULL_TILES];
+
+  tiles.runs = 0;
+  for (int tz = 0; tz < tileCount; tz++) {
+    int row0 = tz * tileQuads, row1 = std::min(row0 + tileQuads, tess);
+
+    for (int tx = 0; tx < tileCount; tx++) {
+      int column0 = tx * tileQuads, column1 = std::min(column0 + tileQuads, tess);
+      visible[tx] = boxInView(mvp,
+        glm::vec3(-1.0 + column0 * stepSize - reach, -amplitude, -1.0 + row0 * stepSize - reach),
+        glm::vec3(-1.0 + column1 * stepSize + reach, amplitude, -1.0 + row1 * stepSize + reach));
+      if (visible[tx])
+        tiles.drawn++;
+      else
+        tiles.culled++;
+    }
+
+    // Each row across each run of visible tiles
+    for (int row = row0; row < row1; row++)
+      for (int tx = 0; tx < tileCount; tx++) {
+        if (!visible[tx] || (tx && visible[tx - 1]))
+          continue;
+        int end = tx;
+        while (end < tileCount && visible[end])
+          end++;
+        int column0 = tx * tileQuads, column1 = std::min(end * tileQuads, tess);
+        if (strips)
+          addTileRun(row * rowIndices + 2 * column0, 2 * (column1 - column0 + 1), true);
+        else
+          addTileRun(row * rowIndices + 6 * column0, 6 * (column1 - column0), false);
+      }
+  }
+  for (int i = 0; i < tiles.runs; i++)
+    tiles.offsets[i] = BUFFER_OFFSET(tiles.firsts[i] * indexSize);
+}
+
+void releaseTileRuns()
+{
+  free(tiles.counts);
+  free(tiles.firsts);
+  free(tiles.offsets);
+  memset(&tiles, 0, sizeof tiles);
 }
 
 /* ########## VBO SETUP, BINDING, UNDBINDING ########## */
-void bindVBOs()
+void releaseStream()
+{
+  for (int i = 0; i < STREAM_SEGMENTS; i++) {
+    if (stream.fences[i])
+      glDeleteSync(stream.fences[i]);
+    stream.fences[i] = 0;
+  }
+  stateDeleteVertexArrays(STREAM_SEGMENTS, stream.vaos);
+  memset(stream.vaos, 0, sizeof stream.vaos);
+  if (stream.mapped) {
+    stateBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    stream.mapped = NULL;
+  }
+  stateDeleteBuffers(1, &vbo);
+  vbo = 0;
+  stream.numVerts = 0;
+  stream.segment = -1;
+}
+
+void allocStream(size_t verts)
 {
-  // Generate buffers for verticies, indices and colors
+  releaseStream();
+
   glGenBuffers(1, &vbo);
-  glGenBuffers(1, &ibo);
+  stateBindBuffer(GL_ARRAY_BUFFER, vbo);
+  if (stream.persistent) {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr size = STREAM_SEGMENTS * verts * sizeof(Vertex);
+    glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+    stream.mapped = (Vertex*) glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+  }
+  else
+    glBufferData(GL_ARRAY_BUFFER, verts * sizeof(Vertex), NULL, GL_STREAM_DRAW);
+  stream.numVerts = verts;
+
+  // Core profile: the attribute pointers of each segment are set up once, here
+  if (g.core) {
+    int segments = stream.persistent ? STREAM_SEGMENTS : 1;
+    glGenVertexArrays(segments, stream.vaos);
+    for (int i = 0; i < segments; i++) {
+      size_t offset = i * verts * sizeof(Vertex);
+      stateBindVertexArray(stream.vaos[i]);
+      glEnableVertexAttribArray(a_position);
+      glEnableVertexAttribArray(a_normal);
+      glEnableVertexAttribArray(a_color);
+      glVertexAttribPointer(a_position, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), BUFFER_OFFSET(offset));
+      glVertexAttribPointer(a_normal, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), BUFFER_OFFSET(offset + sizeof(glm::vec3)));
+      glVertexAttribPointer(a_color, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), BUFFER_OFFSET(offset + sizeof(glm::vec3) + sizeof(glm::vec3)));
+    }
+    stateBindVertexArray(0);
+  }
+}
+
+// Returns where the next copy of the mesh is to be written
+Vertex* beginStreamWrite()
+{
+  size_t size = stream.numVerts * sizeof(Vertex);
+
+  if (stream.persistent) {
+    // Everything drawn from the current segment so far is before this fence
+    if (stream.segment >= 0)
+      stream.fences[stream.segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    stream.segment = (stream.segment + 1) % STREAM_SEGMENTS;
+
+    GLsync fence = stream.fences[stream.segment];
+    if (fence) {
+      while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+        ;
+      glDeleteSync(fence);
+      stream.fences[stream.segment] = 0;
+    }
+    return stream.mapped + stream.segment * stream.numVerts;
+  }
 
-  // Verticies
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(GL_ARRAY_BUFFER, numVerts * sizeof(Vertex), vertices, GL_STATIC_DRAW);
+  // Orphan the old storage so the driver needn't wait for draws using it
+  stream.segment = 0;
+  stateBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+  return (Vertex*) glMapBufferRange(GL_ARRAY_BUFFER, 0, size,
+    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+}
 
-  // Indices
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+void endStreamWrite()
+{
+  if (!stream.persistent) {
+    stateBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+  }
+}
 
-  // Enable pointers to vertex and normal coordinate arrays
-  glEnableClientState(GL_VERTEX_ARRAY);
-  glEnableClientState(GL_NORMAL_ARRAY);
-  glEnableClientState(GL_COLOR_ARRAY);
+void bindVBOs()
+{
+  // Buffers themselves are created by initVBOs() and drawVBOShape()
+  profileBegin(p_upload);
+  stateBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+  // Enable pointers to vertex and normal coordinate arrays (VAOs in the core profile)
+  if (!g.core) {
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+  }
+  profileEnd(p_upload);
 }
 
 void unbindVBOs()
 {
   // Disable client states that were previously enabled
-  glDisableClientState(GL_VERTEX_ARRAY);
-  glDisableClientState(GL_NORMAL_ARRAY);
-  glDisableClientState(GL_COLOR_ARRAY);
-
-  // Free memory allocated to indicies and vertices
-  free(indices);
-  free(vertices);
-
-  // Unbind buffers of VBOs when switching rendering mode (empty them)
-  int buffer;
+  if (!g.core) {
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+  }
 
+  // Unbind buffers of VBOs when switching rendering mode (empty them), the
+  // calls are dropped if they are unbound already
   // [1]. Array Buffers (Verticies)
-  glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &buffer);
-  if (buffer != 0)
-     glBindBuffer(GL_ARRAY_BUFFER, 0);
+  stateBindBuffer(GL_ARRAY_BUFFER, 0);
 
   // [2]. Element Array Buffers (Indices)
-  glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &buffer);
-  if (buffer != 0)
-     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  // Release the vertex buffer, it is recreated by initVBOs(). The index
+  // buffers stay cached for when VBOs are turned back on
+  releaseStream();
+  vertices = NULL;
+}
+
+/* Rows of the mesh are independent, so they are built by the worker pool,
+ * each band of rows writing straight into its part of vertices/indices */
+typedef struct {
+  int tess;
+  void (*buildRow)(int, int, Vertex*);
+  void* indices;     // mapped index buffer
+  bool shorts;       // 16-bit rather than 32-bit indices
+  bool strips;
+} MeshJob;
+
+// Vertices per band worth handing to a worker thread
+#define MESH_GRAIN 4096
+
+void buildVertexRows(int begin, int end, void* data)
+{
+  MeshJob* job = (MeshJob*) data;
+  for (int j = begin; j < end; ++j)
+    job->buildRow(job->tess, j, &vertices[j * (job->tess + 1)]);
+}
+
+size_t indicesPerRow(int tess, bool strips)
+{
+  // Strips have two indices per column and a restart, lists two triangles per quad
+  return strips ? 2 * (tess + 1) + 1 : tess * 6;
+}
+
+void buildIndexRows(int begin, int end, void* data)
+{
+  MeshJob* job = (MeshJob*) data;
+  size_t tess = job->tess;
+  size_t index = begin * indicesPerRow(tess, job->strips);
+  unsigned restart = job->shorts ? 0xFFFF : 0xFFFFFFFF;
+  unsigned* ints = (unsigned*) job->indices;
+  GLushort* shorts = (GLushort*) job->indices;
+  unsigned row[6];
+  int count;
+
+  for (int i = begin; i < end; ++i) {
+    for (size_t j = 0; j <= tess; ++j) {
+      if (job->strips) {
+        // Same triangles (and winding) as the list below
+        row[0] = i * (tess + 1) + j;
+        row[1] = (i + 1) * (tess + 1) + j;
+        count = 2;
+      }
+      else if (j < tess) {
+        row[0] = i * (tess + 1) + j;
+        row[1] = (i + 1) * (tess + 1) + j;
+        row[2] = i * (tess + 1) + j + 1;
+        row[3] = i * (tess + 1) + j + 1;
+        row[4] = (i + 1) * (tess + 1) + j;
+        row[5] = (i + 1) * (tess + 1) + j + 1;
+        count = 6;
+      }
+      else
+        count = 0;
+
+      for (int k = 0; k < count; ++k) {
+        if (job->shorts)
+          shorts[index++] = row[k];
+        else
+          ints[index++] = row[k];
+      }
+    }
+    if (job->strips) {
+      if (job->shorts)
+        shorts[index++] = restart;
+      else
+        ints[index++] = restart;
+    }
+  }
+}
+
+// Index buffer for a tess level and layout, built the first time it is used
+IndexBuffer* indexBuffer(int tess, bool strips)
+{
+  IndexBuffer* entry = &indexCache[0];
+
+  indexCacheClock++;
+  for (int i = 0; i < INDEX_CACHE_SIZE; i++) {
+    if (indexCache[i].tess == tess && indexCache[i].strips == strips) {
+      indexCache[i].lastUse = indexCacheClock;
+      return &indexCache[i];
+    }
+    if (indexCache[i].lastUse < entry->lastUse)
+      entry = &indexCache[i];
+  }
+
+  // Not cached, replace the least recently used (or an unused) entry
+  MeshJob job = { tess, NULL, NULL, (tess + 1) * (tess + 1) < 65536, strips };
+  size_t indexSize = job.shorts ? sizeof(GLushort) : sizeof(GLuint);
+  size_t count = tess * indicesPerRow(tess, strips);
+
+  if (!entry->buffer)
+    glGenBuffers(1, &entry->buffer);
+  entry->tess = tess;
+  entry->strips = strips;
+  entry->count = count;
+  entry->type = job.shorts ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+  entry->lastUse = indexCacheClock;
+
+  stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, entry->buffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * indexSize, NULL, GL_STATIC_DRAW);
+  job.indices = glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, count * indexSize,
+    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  parallelFor(tess, MESH_GRAIN / (tess + 1) + 1, buildIndexRows, &job);
+  glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+
+  return entry;
+}
+
+void releaseIndexCache()
+{
+  for (int i = 0; i < INDEX_CACHE_SIZE; i++) {
+    stateDeleteBuffers(1, &indexCache[i].buffer);
+    indexCache[i].buffer = 0;
+    indexCache[i].tess = 0;
+    indexCache[i].lastUse = 0;
+  }
+}
+
+void initMeshVBO(int tess, void (*buildRow)(int, int, Vertex*))
+{
+  MeshJob job = { tess, buildRow, NULL, false, false };
+  int grain = MESH_GRAIN / (tess + 1) + 1;
+
+  // Calculate number of verts to use in calculations
+  numVerts = (tess + 1) * (tess + 1);
+  if (stream.numVerts != numVerts)
+    allocStream(numVerts);
+  stream.tess = tess;
+
+  // [1.] Store vertices, straight into the buffer, indices come from indexBuffer()
+  profileBegin(p_upload);
+  vertices = beginStreamWrite();
+  profileEnd(p_upload);
+
+  profileBegin(p_build);
+  parallelFor(tess + 1, grain, buildVertexRows, &job);
+  profileEnd(p_build);
+
+  profileBegin(p_upload);
+  endStreamWrite();
+  profileEnd(p_upload);
 }
 
 void initGridVBO(int tess)
 {
   /* NOTE: With VBOs, both the grid and sine wave have been drawn using GL_TRIANGLES
    * instead of GL_QUADS. The code for calculating index and storing indices is
-   * mainly based on assignment 1. */
+   * mainly based on assignment 1.
+   * Logic is essentially the same as drawGrid(), but we found the r.z += stepSize,
+   * section wasn't required, so it was left out */
+  initMeshVBO(tess, gridRow);
+}
 
-  // Set up variables (same as drawGrid)
-  const float A1 = 0.25, k1 = 2.0 * M_PI, w1 = 0.25;
-  const float A2 = 0.25, k2 = 2.0 * M_PI, w2 = 0.25;
-  glm::vec3 r, n, rEC, nEC;
-  float x, z;
-  float stepSize = 2.0 / tess;
+void initWaveVBO(int tess)
+{
+  /* Uses same rows as drawSineWave(), instead of glColor3fv etc. the values are
+   * stored, glDrawElements will then draw the shapes using these vertices, also
+   * passing them into the shader, if enabled */
+  buildWaveTable(tess, g.t);
+  initMeshVBO(tess, waveRow);
+}
 
-  // Calculate number of verts and indices to use in calculations
-  numVerts = (tess + 1) * (tess + 1);
-  numIndices = tess * tess * 6;
-  // Allocate memory to indices and verties to place later in buffers
-  vertices = (Vertex*) calloc(numVerts, sizeof(Vertex));
-  indices = (unsigned int*) calloc(numIndices, sizeof(int));
+void initVBOs()
+{
+  // Determine appropriate shape to initialize
+  if(g.wave)
+    initWaveVBO(g.tess);
+  else
+    initGridVBO(g.tess);
 
-  /* [1.] Store vertices
-   * - Logic is essentially the same as drawGrid(), but we found the r.z += stepSize,
-   * section wasn't required, so it was left out */
-  for (size_t j = 0; j <= tess; ++j) {
-    for (size_t i = 0; i <= tess; ++i) {
-      r.x = -1.0 + i * stepSize;
-      r.z = -1.0 + j * stepSize;
-      r.y = 0.0;
+  // Remember what the mesh was built from, see updateVBOs()
+  meshView = modelViewMatrix;
+  meshT = g.t;
+  pendingChanges = c_ui;
+}
+
+void resetVBOS()
+{
+  /* Recalculate new values of VBO, used when tesselating, animating sine wave or
+   * moving the camera with CPU lighting. Written to the next segment of the stream, buffers are only
+   * recreated when the number of vertices changes */
+  initVBOs();
+}
+
+/* Rebuild the VBO mesh only if something it was generated from has changed:
+ * - geometry changes always
+ * - lighting changes when colors are lit on the CPU
+ * - the modelViewMatrix (camera, multiview) only when colors are lit on the
+ *   CPU, positions and normals are in object coordinates
+ * - time (animation) unless the shader computes y and nothing is lit on the CPU
+ * uniform and UI changes never need a rebuild, and the gl_VertexID mesh none */
+void updateVBOs()
+{
+  bool cpuLit = g.lighting && !g.fixed;
+  bool gpuY = g.wave && g.useShaders && g.fixed;
+  const char* reason = NULL;
+
+  // Nothing to build, and the buffers of the last mesh built aren't needed
+  if (vertexIdMesh() || lodMesh() || tessMesh()) {
+    if (stream.numVerts) {
+      releaseStream();
+      releaseIndexCache();
+    }
+    pendingChanges = c_ui;
+    return;
+  }
+
+  if (stream.numVerts == 0 || (pendingChanges & c_geometry))
+    reason = "geometry";
+  else if (cpuLit && (pendingChanges & c_lighting))
+    reason = "lighting";
+  else if (cpuLit && meshView != modelViewMatrix)
+    reason = "view";
+  else if (g.wave && (!gpuY || cpuLit) && meshT != g.t)
+    reason = "time";
+
+  // Changes the current mesh doesn't depend on are dropped
+  pendingChanges = c_ui;
+
+  if (reason) {
+    if (debug[d_rebuild])
+      printf("rebuild: %s\n", reason);
+    resetVBOS();
+  }
+}
+
+// Color of the meshes the shaders make, that of the VBO mesh's vertices
+void setShaderMeshColor()
+{
+  if (g.core)
+    glVertexAttrib3fv(a_color, &cyan[0]);
+  else
+    glColor3fv(&cyan[0]);
+}
+
+/* The mesh from gl_VertexID, as the triangle list of the index buffer (strips
+ * would take a draw or an instance per row), in the color its vertices would
+ * have had */
+void drawVertexIdMesh(int instances)
+{
+  profileBegin(p_draw);
+  bindEmptyVertexArray();
+  setShaderMeshColor();
+  // Instanced draws (single pass multiview) cover every view, so aren't culled
+  if (g.cull && instances == 1) {
+    selectTileRuns(g.tess, false, 6 * g.tess, 0);
+    glMultiDrawArrays(GL_TRIANGLES, tiles.firsts, tiles.counts, tiles.runs);
+  }
+  else
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6 * g.tess * g.tess, instances);
+  stateBindVertexArray(0);
+  profileEnd(p_draw);
+}
 
-      size_t index = j * (tess + 1) + i;
-      rEC = glm::vec3(modelViewMatrix * glm::vec4(r, 1.0));
-      vertices[index].pos = rEC;
+/* Put the chunks of the view in the LodChunks block's buffer. It is orphaned
+ * first, the draws of the previous view may still be reading it */
+void uploadLodChunks()
+{
+  if (!lod.buffer)
+    glGenBuffers(1, &lod.buffer);
+  stateBindBuffer(GL_UNIFORM_BUFFER, lod.buffer);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof lod.chunks, NULL, GL_STREAM_DRAW);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, lod.count * sizeof(LodChunk), lod.chunks);
+}
 
-      if (g.lighting) {
-        n = glm::vec3(0.0, 1.0, 0.0);
-        nEC = normalMatrix * glm::normalize(n);
-        if (g.fixed) {
-          vertices[index].normal = nEC;
-        } else {
-          glm::vec3 colors = computeLighting(rEC, nEC);
-          vertices[index].color = colors;
-        }
-      }
-      else
-        vertices[index].color = cyan;
-    }
+/* Bind the LodChunks block to the chunks from first, LOD_BATCH of them (the
+ * buffer holds LOD_MAX_CHUNKS, a multiple), and return how many to draw */
+int bindLodBatch(int first)
+{
+  stateBindBufferRange(GL_UNIFORM_BUFFER, LOD_BINDING, lod.buffer,
+    first * sizeof(LodChunk), LOD_BATCH * sizeof(LodChunk));
+  return std::min(lod.count - first, LOD_BATCH);
+}
+
+/* The quadtree LOD chunks of the view, an instance of the chunk grid's indices
+ * each, placed by the lighting program from their LodChunks. They share a
+ * level, so a draw takes up to LOD_BATCH of them */
+void drawLodChunks()
+{
+  selectLodChunks();
+
+  profileBegin(p_upload);
+  IndexBuffer* ib = indexBuffer(LOD_CHUNK, g.strips);
+  uploadLodChunks();
+  profileEnd(p_upload);
+
+  profileBegin(p_draw);
+  bindEmptyVertexArray();
+  stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ib->buffer);
+  setShaderMeshColor();
+  if (ib->strips) {
+    stateEnable(GL_PRIMITIVE_RESTART);
+    glPrimitiveRestartIndex(ib->type == GL_UNSIGNED_SHORT ? 0xFFFF : 0xFFFFFFFF);
   }
+  glUniform1i(activeUniforms->lod, GL_TRUE);
+  for (int first = 0; first < lod.count; first += LOD_BATCH)
+    glDrawElementsInstanced(ib->strips ? GL_TRIANGLE_STRIP : GL_TRIANGLES, ib->count, ib->type, 0,
+      bindLodBatch(first));
+  if (ib->strips)
+    stateDisable(GL_PRIMITIVE_RESTART);
+
+  // Back to the mesh of vertex arrays for the program's next draw
+  glUniform1i(activeUniforms->lod, GL_FALSE);
+  stateBindVertexArray(0);
+  profileEnd(p_draw);
+}
 
-  // [2]. Store indices
-  size_t index = 0;
-  for (size_t i = 0; i < tess ; ++i) {
-    for (size_t j = 0; j < tess; ++j) {
-      indices[index++] = i * (tess + 1) + j;
-      indices[index++] = (i + 1) * (tess + 1) + j;
-      indices[index++] = i * (tess + 1) + j + 1;
-      indices[index++] = i * (tess + 1) + j + 1;
-      indices[index++] = (i + 1) * (tess + 1) + j;
-      indices[index++] = (i + 1) * (tess + 1) + j + 1;
+/* The patch grid, each patch a quad that tess.tesc subdivides as finely as
+ * the wave's curvature needs at the view's scale, and tess.tese places and
+ * lights like shader.vert. Patches outside the view are dropped by tess.tesc */
+void drawTessPatches()
+{
+  profileBegin(p_draw);
+  bindEmptyVertexArray();
+  setShaderMeshColor();
+  glUniform1f(tessUniforms.pixels, pixelsPerUnit());
+  glPatchParameteri(GL_PATCH_VERTICES, 4);
+  if (!tessBatches.counts[0])
+    for (int i = 0; i < TESS_DRAWS; i++) {
+      tessBatches.firsts[i] = 4 * TESS_BATCH * i;
+      tessBatches.counts[i] = 4 * TESS_BATCH;
     }
-  }
+  glMultiDrawArrays(GL_PATCHES, tessBatches.firsts, tessBatches.counts, TESS_DRAWS);
+  stateBindVertexArray(0);
+  profileEnd(p_draw);
 }
 
-void initWaveVBO(int tess)
+// Draws the latest mesh, instances times when given (single pass multiview)
+void drawVBOShape(int instances = 1)
 {
-  // Same variables as initGridVBO() except time added for wave animation
-  const float A1 = 0.25, k1 = 2.0 * M_PI, w1 = 0.25;
-  const float A2 = 0.25, k2 = 2.0 * M_PI, w2 = 0.25;
-  glm::vec3 r, n, rEC, nEC, lrEC, lnEC, c;
-  float x, z;
-  float stepSize = 2.0 / tess;
-  float t = g.t;
+  if (lodMesh()) {
+    drawLodChunks();
+    return;
+  }
+  if (tessMesh()) {
+    drawTessPatches();
+    return;
+  }
+  if (vertexIdMesh()) {
+    drawVertexIdMesh(instances);
+    return;
+  }
 
-  numVerts = (tess + 1) * (tess + 1);
-  numIndices = tess * tess * 6;
-  vertices = (Vertex*) calloc(numVerts, sizeof(Vertex));
-  indices = (unsigned int*) calloc(numIndices, sizeof(int));
-
-  /* [1]. Store vertices
-   * Uses same logic as drawSineWave(), instead replacing calls such as:
-   * - glColor3fv with vertices[index].color, as we are storing these values instead
-   * - glDrawElements will pass then draw the shapes using these vertices, also passing
-   * them into the shader, if enabled */
-  for (size_t j = 0; j <= tess; ++j) {
-    for (size_t i = 0; i <= tess; ++i) {
-      r.x = -1.0 + i * stepSize;
-      r.z = -1.0 + j * stepSize;
+  // Segment of the stream holding the latest mesh
+  size_t offset = stream.segment * stream.numVerts * sizeof(Vertex);
 
-      if(g.waveDim == 2) {
-        if (g.useShaders && g.fixed)
-          r.y = 0.0;
-        else {
-          r.y = A1 * sinf(k1 * r.x + w1 * t);
-          if (g.lighting) {
-            n.x = - A1 * k1 * cosf(k1 * r.x + w1 * t);
-            n.y = 1.0;
-            n.z = 0.0;
-          }
-        }
-      } else if (g.waveDim == 3) {
-        if (g.useShaders && g.fixed)
-          r.y = 0.0;
-        else {
-          r.y = A1 * sinf(k1 * r.x + w1 * t) + A2 * sinf(k2 * r.z + w2 * t);
-          if (g.lighting) {
-            n.x = - A1 * k1 * cosf(k1 * r.x + w1 * t);
-            n.y = 1.0;
-            n.z = - A2 * k2 * cosf(k2 * r.z + w2 * t);
-          }
-        }
-      }
+  profileBegin(p_upload);
+  IndexBuffer* ib = indexBuffer(stream.tess, g.strips);
+  profileEnd(p_upload);
 
-      // Calculate index to store vertex at
-      size_t index = j * (tess + 1) + i;
-
-      /* When shaders on, ignore modelViewMatrix and normal, since it is passed into shader
-       * it is required however for lighting calculations (when fixed is off) */
-      if (g.useShaders) {
-        rEC = glm::vec3(glm::vec4(r, 1.0));
-        nEC = glm::normalize(n);
-        if(g.lighting) {
-          if(g.fixed)
-            vertices[index].normal = nEC;
-          else {
-            lrEC = glm::vec3(modelViewMatrix * glm::vec4(r, 1.0));
-            lnEC = normalMatrix * glm::normalize(n);
-            c = computeLighting(lrEC, lnEC);
-            glColor3fv(&c[0]);
-          }
-        }
-      } else {
-        rEC = glm::vec3(modelViewMatrix * glm::vec4(r, 1.0));
-        nEC = normalMatrix * glm::normalize(n);
-        if(g.lighting) {
-          if(g.fixed)
-            vertices[index].normal = nEC;
-          else {
-            c = computeLighting(rEC, nEC);
-            vertices[index].color = c;
-          }
-        }
-        else
-          vertices[index].color = cyan;
-      }
-      vertices[index].pos = rEC;
-
-      /* Applicable only to 3D wave, essentially same calcuations as above, also
-       * mirroring drawSineWave() */
-      if (g.waveDim == 3) {
-        if (g.useShaders && g.fixed)
-          r.y = 0.0;
-        else {
-          r.y = A1 * sinf(k1 * r.x + w1 * t) + A2 * sinf(k2 * r.z + w2 * t);
-          if (g.lighting) {
-            n.z = - A2 * k2 * cosf(k2 * r.z + w2 * t);
-          }
-        }
-      }
+  profileBegin(p_draw);
 
-      if (g.useShaders) {
-        rEC = glm::vec3(glm::vec4(r, 1.0));
-        nEC = glm::normalize(n);
-        if(g.lighting) {
-          if(g.fixed)
-            vertices[index].normal = nEC;
-          else {
-            lrEC = glm::vec3(modelViewMatrix * glm::vec4(r, 1.0));
-            lnEC = normalMatrix * glm::normalize(n);
-            c = computeLighting(lrEC, lnEC);
-            vertices[index].color = c;
-          }
-        }
-      } else {
-        rEC = glm::vec3(modelViewMatrix * glm::vec4(r, 1.0));
-        nEC = normalMatrix * glm::normalize(n);
-        if(g.lighting) {
-          if(g.fixed)
-            vertices[index].normal = nEC;
-          else {
-            c = computeLighting(rEC, nEC);
-            vertices[index].color = c;
-          }
-        }
-        else
-          vertices[index].color = cyan;
-      }
-      vertices[index].pos = rEC;
-    }
-  }
+  // The core profile's VAO per segment already points at it
+  if (g.core)
+    stateBindVertexArray(stream.vaos[stream.segment]);
+  else {
+    stateBindBuffer(GL_ARRAY_BUFFER, vbo);
 
-  // [2]. Store indices
-  size_t index = 0;
-  for (size_t i = 0; i < tess ; ++i) {
-    for (size_t j = 0; j < tess; ++j) {
-      indices[index++] = i * (tess + 1) + j;
-      indices[index++] = (i + 1) * (tess + 1) + j;
-      indices[index++] = i * (tess + 1) + j + 1;
-      indices[index++] = i * (tess + 1) + j + 1;
-      indices[index++] = (i + 1) * (tess + 1) + j;
-      indices[index++] = (i + 1) * (tess + 1) + j + 1;
-    }
+    // Set up pointers to in order to draw verties and indices
+    glVertexPointer(3, GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(offset));
+    glNormalPointer(GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(offset + sizeof(glm::vec3)));
+    glColorPointer(3, GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(offset + sizeof(glm::vec3) + sizeof(glm::vec3)));
   }
-}
+  stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ib->buffer);
 
-void initVBOs()
-{
-  // Determine appropriate shape to initialize
-  if(g.wave)
-    initWaveVBO(g.tess);
+  // Draw all elements specified via VBOs, those of visible tiles when culling
+  GLenum mode = ib->strips ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+  if (ib->strips) {
+    stateEnable(GL_PRIMITIVE_RESTART);
+    glPrimitiveRestartIndex(ib->type == GL_UNSIGNED_SHORT ? 0xFFFF : 0xFFFFFFFF);
+  }
+  if (g.cull && instances == 1) {
+    selectTileRuns(stream.tess, ib->strips, indicesPerRow(stream.tess, ib->strips),
+      ib->type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+    glMultiDrawElements(mode, tiles.counts, ib->type, tiles.offsets, tiles.runs);
+  }
   else
-    initGridVBO(g.tess);
-}
-
-void resetVBOS()
-{
-  /* Recalculate new values of VBO, used when tesselating, moving camera, animating
-   * sine wave */
-  unbindVBOs();
-  initVBOs();
-  bindVBOs();
+    glDrawElementsInstanced(mode, ib->count, ib->type, 0, instances);
+  if (ib->strips)
+    stateDisable(GL_PRIMITIVE_RESTART);
+  profileEnd(p_draw);
 }
 
-void drawVBOShape()
+/* Normals of the whole mesh in one draw, its vertices drawn as points that
+ * normals.geom turns into lines. The wave and its normals are recomputed as in
+ * shader.vert, so only x and z of the mesh are used. Returns false if normals
+ * have to be drawn on the CPU instead (no geometry shaders, immediate mode, or
+ * the spectrum without shaders, whose mesh has x and z moved by the waves) */
+bool drawMeshNormals()
 {
-  // Set up pointers to in order to draw verties and indices
-  glVertexPointer(3, GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(0));
-  glNormalPointer(GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(sizeof(glm::vec3)));
-  glColorPointer(3, GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(sizeof(glm::vec3) + sizeof(glm::vec3)));
+  if (!normalsProgram || !g.vbo || (waveDimension() == 4 && !g.useShaders))
+    return false;
+
+  // Up to date already unless called ahead of the mesh (single pass multiview)
+  updateVBOs();
+  size_t offset = stream.segment * stream.numVerts * sizeof(Vertex);
+
+  profileBegin(p_normals);
+  stateUseProgram(normalsProgram);
+  setShadingState();
+  glUniform1f(normalsUniforms.normalLength, 0.05);
+
+  if (lodMesh()) {
+    // Each chunk's vertices, an instance each as drawLodChunks()
+    selectLodChunks();
+    uploadLodChunks();
+    bindEmptyVertexArray();
+    glUniform1i(normalsUniforms.lod, GL_TRUE);
+    for (int first = 0; first < lod.count; first += LOD_BATCH)
+      glDrawArraysInstanced(GL_POINTS, 0, (LOD_CHUNK + 1) * (LOD_CHUNK + 1), bindLodBatch(first));
+    glUniform1i(normalsUniforms.lod, GL_FALSE);
+    stateBindVertexArray(0);
+  }
+  else if (vertexIdMesh() || tessMesh()) {
+    // Only at the corners of the patches for the tessellation shaders
+    int tess = tessMesh() ? TESS_PATCHES : g.tess;
+    bindEmptyVertexArray();
+    glDrawArrays(GL_POINTS, 0, (tess + 1) * (tess + 1));
+    stateBindVertexArray(0);
+  }
+  else {
+    if (g.core)
+      stateBindVertexArray(stream.vaos[stream.segment]);
+    else {
+      stateBindBuffer(GL_ARRAY_BUFFER, vbo);
+      glVertexPointer(3, GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(offset));
+    }
+    glDrawArrays(GL_POINTS, 0, stream.numVerts);
+  }
 
-  // Draw all elements specified via VBOs
-  glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
+  stateUseProgram(0);
+  profileEnd(p_normals);
+  return true;
 }
 
 /* ########## DRAWING SHAPES (GRID/SINEWAVE) ########## */
 void drawGrid(int tess)
 {
-  /* Since there are 4 types of views being displayed at once, vbo has to update for each window
-   * shown in the multiView */
-  if(g.vbo && g.multiView)
-    resetVBOS();
+  /* The 4 views of multiView share the vbo, which only has to update for each window
+   * when lit on the CPU, updateVBOs() picks up the change of matrices */
+  if(g.vbo)
+    updateVBOs();
 
   float stepSize = 2.0 / tess;
   glm::vec3 r, n, rEC, nEC;
   int i, j;
 
-  if (g.lighting && g.fixed) {
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
-    glEnable(GL_NORMALIZE);
-    glShadeModel(GL_SMOOTH);
+  if (g.core) {
+    // No fixed pipeline, shader330.vert keeps the flat grid's y and normals
+    applyShading();
+  }
+  else if (g.lighting && g.fixed) {
+    stateEnable(GL_LIGHTING);
+    stateEnable(GL_LIGHT0);
+    stateEnable(GL_NORMALIZE);
+    stateShadeModel(GL_SMOOTH);
     if (g.twoside)
-      glLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, &cyanDiffuse[0]);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, &grey[0]);
-    glMaterialf(GL_FRONT, GL_SHININESS, g.shininess);
+      stateLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
+    stateMaterialfv(GL_FRONT, GL_DIFFUSE, &cyanDiffuse[0]);
+    stateMaterialfv(GL_FRONT, GL_SPECULAR, &grey[0]);
+    stateMaterialf(GL_FRONT, GL_SHININESS, g.shininess);
   } else {
-    glDisable(GL_LIGHTING);
+    stateDisable(GL_LIGHTING);
     glColor3fv(&cyan[0]);
   }
 
   if (g.wireframe)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    statePolygonMode(GL_FRONT_AND_BACK, GL_LINE);
   else
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    statePolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+  // Vertices are in object coordinates (uModelViewMat in the core profile)
+  if (!g.core) {
+    glPushMatrix();
+    glLoadMatrixf(&modelViewMatrix[0][0]);
+  }
 
   // Render using VBOs
   if (g.vbo) {
@@ -892,55 +2792,20 @@ void drawGrid(int tess)
   }
   // Render via immediate mode
   else {
-    for (j = 0; j < tess; j++) {
-      glBegin(GL_QUAD_STRIP);
-      for (i = 0; i <= tess; i++) {
-        r.x = -1.0 + i * stepSize;
-        r.y = 0.0;
-        r.z = -1.0 + j * stepSize;
-
-        if (g.lighting) {
-          n.x = 0.0;
-          n.y = 1.0;
-          n.z = 0.0;
-        }
-
-        rEC = glm::vec3(modelViewMatrix * glm::vec4(r, 1.0));
-        if (g.lighting) {
-          nEC = normalMatrix * glm::normalize(n);
-          if (g.fixed) {
-            glNormal3fv(&nEC[0]);
-          } else {
-            glm::vec3 c = computeLighting(rEC, nEC);
-            glColor3fv(&c[0]);
-          }
-        }
-        glVertex3fv(&rEC[0]);
-
-        r.z += stepSize;
-
-        rEC = glm::vec3(modelViewMatrix * glm::vec4(r, 1.0));
-        if (g.lighting) {
-          nEC = normalMatrix * glm::normalize(n);
-          if (g.fixed) {
-            glNormal3fv(&nEC[0]);
-          } else {
-            glm::vec3 c = computeLighting(rEC, nEC);
-            glColor3fv(&c[0]);
-          }
-        }
-        glVertex3fv(&rEC[0]);
-      }
-
-      glEnd();
-    }
+    drawRows(tess, gridRow);
   }
 
-  if (g.lighting)
-    glDisable(GL_LIGHTING);
+  if (g.core)
+    stateUseProgram(0);
+  else {
+    glPopMatrix();
+    if (g.lighting)
+      stateDisable(GL_LIGHTING);
+  }
 
   // Normals
-  if (g.drawNormals) {
+  if (g.drawNormals && !drawMeshNormals()) {
+    profileBegin(p_normals);
     for (j = 0; j <= tess; j++) {
       for (i = 0; i <= tess; i++) {
         r.x = -1.0 + i * stepSize;
@@ -955,6 +2820,7 @@ void drawGrid(int tess)
         drawVector(rEC, nEC, 0.05, true, yellow);
       }
     }
+    profileEnd(p_normals);
   }
 
   while ((err = glGetError()) != GL_NO_ERROR) {
@@ -963,24 +2829,42 @@ void drawGrid(int tess)
   }
 }
 
+void drawWaveNormals(int tess)
+{
+  glm::vec3 r[LIGHTING_CHUNK], n[LIGHTING_CHUNK], rEC, nEC;
+  int i0, j;
+
+  if (drawMeshNormals())
+    return;
+
+  profileBegin(p_normals);
+  buildWaveTable(tess, g.t);
+  for (j = 0; j <= tess; j++) {
+    for (i0 = 0; i0 <= tess; i0 += LIGHTING_CHUNK) {
+      int count = std::min(LIGHTING_CHUNK, tess + 1 - i0);
+      waveVertices(i0, j, count, r, n);
+
+      for (int k = 0; k < count; k++) {
+        rEC = glm::vec3(modelViewMatrix * glm::vec4(r[k], 1.0));
+        nEC = normalMatrix * glm::normalize(n[k]);
+        drawVector(rEC, nEC, 0.05, true, yellow);
+      }
+    }
+  }
+  profileEnd(p_normals);
+}
+
 void drawSineWave(int tess)
 {
   /* [1]. Refresh sine wave only when not using shaders because if shaders are in use,
    * vbo doesn't need to be recalculated. The y values are instead updated in GPU.
-   * [2]. When shaders off however, reset the vbo for when it is animating or if
-   * the display is set to multiView, as there are 4 differing types that need to be
-   * rendered */
+   * [2]. When shaders off however, reset the vbo for when it is animating. The views
+   * of multiView share it, the modelViewMatrix being loaded when drawing, unless lit
+   * on the CPU. updateVBOs() tracks both */
 
-  if(g.vbo && !g.useShaders) {
-    if(g.animate || g.multiView)
-      resetVBOS();
-  }
+  if(g.vbo)
+    updateVBOs();
 
-  const float A1 = 0.25, k1 = 2.0 * M_PI, w1 = 0.25;
-  const float A2 = 0.25, k2 = 2.0 * M_PI, w2 = 0.25;
-  float stepSize = 2.0 / tess;
-  glm::vec3 r, n, rEC, nEC, lrEC, lnEC, c;
-  int i, j;
   float t = g.t;
 
   if (g.useShaders) {
@@ -988,170 +2872,80 @@ void drawSineWave(int tess)
   }
   else if (g.lighting && g.fixed) {
     glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
-    glEnable(GL_NORMALIZE);
+    stateEnable(GL_LIGHTING);
+    stateEnable(GL_LIGHT0);
+    stateEnable(GL_NORMALIZE);
     if (g.flat)
-      glShadeModel(GL_FLAT);
+      stateShadeModel(GL_FLAT);
     else
-      glShadeModel(GL_SMOOTH);
+      stateShadeModel(GL_SMOOTH);
     if (g.twoside)
-      glLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, &cyanDiffuse[0]);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, &grey[0]);
-    glMaterialf(GL_FRONT, GL_SHININESS, g.shininess);
+      stateLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
+    stateMaterialfv(GL_FRONT, GL_DIFFUSE, &cyanDiffuse[0]);
+    stateMaterialfv(GL_FRONT, GL_SPECULAR, &grey[0]);
+    stateMaterialf(GL_FRONT, GL_SHININESS, g.shininess);
   } else {
-    glDisable(GL_LIGHTING);
+    stateDisable(GL_LIGHTING);
     glColor3fv(&cyan[0]);
   }
 
   if (g.wireframe)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    statePolygonMode(GL_FRONT_AND_BACK, GL_LINE);
   else
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    statePolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-  // Sine wave
+  // Sine wave, in object coordinates (the shader uses uModelViewMat instead)
+  if (!g.core) {
+    glPushMatrix();
+    glLoadMatrixf(&modelViewMatrix[0][0]);
+  }
   if (g.vbo)
     drawVBOShape();
   else {
-    for (j = 0; j < tess; j++) {
-      glBegin(GL_QUAD_STRIP);
-      for (i = 0; i <= tess; i++) {
-        r.x = -1.0 + i * stepSize;
-        r.z = -1.0 + j * stepSize;
-
-        if (g.waveDim == 2) {
-          if (g.useShaders && g.fixed)
-            r.y = 0.0;
-          else {
-            r.y = A1 * sinf(k1 * r.x + w1 * t);
-            if (g.lighting) {
-              n.x = - A1 * k1 * cosf(k1 * r.x + w1 * t);
-              n.y = 1.0;
-              n.z = 0.0;
-            }
-          }
-        } else if (g.waveDim == 3) {
-          if (g.useShaders && g.fixed)
-            r.y = 0.0;
-          else {
-            r.y = A1 * sinf(k1 * r.x + w1 * t) + A2 * sinf(k2 * r.z + w2 * t);
-            if (g.lighting) {
-              n.x = - A1 * k1 * cosf(k1 * r.x + w1 * t);
-              n.y = 1.0;
-              n.z = - A2 * k2 * cosf(k2 * r.z + w2 * t);
-            }
-          }
-        }
-
-        /* When shaders on: (reiterate)
-         * - Pass in pos/normal eye coordinate without modelViewMatrix and normalMatrix
-         * - When lighting is on however, it requires normal and modelViewMatrix*/
-        if (g.useShaders) {
-          rEC = glm::vec3(glm::vec4(r, 1.0));
-          nEC = glm::normalize(n);
-          if(g.lighting) {
-            if(g.fixed)
-              glNormal3fv(&nEC[0]);
-            else {
-              lrEC = glm::vec3(modelViewMatrix * glm::vec4(r, 1.0));
-              lnEC = normalMatrix * glm::normalize(n);
-              c = computeLighting(lrEC, lnEC);
-              glColor3fv(&c[0]);
-            }
-          }
-        } // Shaders off, compute normally
-        else {
-          rEC = glm::vec3(modelViewMatrix * glm::vec4(r, 1.0));
-          nEC = normalMatrix * glm::normalize(n);
-          if(g.lighting) {
-            if(g.fixed)
-              glNormal3fv(&nEC[0]);
-            else {
-              c = computeLighting(rEC, nEC);
-              glColor3fv(&c[0]);
-            }
-          }
-        }
-        glVertex3fv(&rEC[0]);
-
-        r.z += stepSize;
-
-        if (g.waveDim == 3) {
-          if (g.useShaders && g.fixed)
-            r.y = 0.0;
-          else {
-            r.y = A1 * sinf(k1 * r.x + w1 * t) + A2 * sinf(k2 * r.z + w2 * t);
-            if (g.lighting) {
-              n.z = - A2 * k2 * cosf(k2 * r.z + w2 * t);
-            }
-          }
-        }
-
-        if (g.useShaders) {
-          rEC = glm::vec3(glm::vec4(r, 1.0));
-          nEC = glm::normalize(n);
-          if(g.lighting) {
-            if(g.fixed)
-              glNormal3fv(&nEC[0]);
-            else {
-              lrEC = glm::vec3(modelViewMatrix * glm::vec4(r, 1.0));
-              lnEC = normalMatrix * glm::normalize(n);
-              c = computeLighting(lrEC, lnEC);
-              glColor3fv(&c[0]);
-            }
-          }
-        } else {
-          rEC = glm::vec3(modelViewMatrix * glm::vec4(r, 1.0));
-          nEC = normalMatrix * glm::normalize(n);
-          if(g.lighting) {
-            if(g.fixed)
-              glNormal3fv(&nEC[0]);
-            else {
-              c = computeLighting(rEC, nEC);
-              glColor3fv(&c[0]);
-            }
-          }
-        }
-        glVertex3fv(&rEC[0]);
-      }
-      glEnd();
-    }
+    buildWaveTable(tess, t);
+    drawRows(tess, waveRow);
   }
+  if (!g.core)
+    glPopMatrix();
 
   // Disable use of shaders if originally enabled
   if(g.useShaders)
-    glUseProgram(0);
-  if (g.lighting)
-    glDisable(GL_LIGHTING);
+    stateUseProgram(0);
+  if (g.lighting && !g.core)
+    stateDisable(GL_LIGHTING);
 
   // Normals
-  if (g.drawNormals) {
-    for (j = 0; j <= tess; j++) {
-      for (i = 0; i <= tess; i++) {
-        r.x = -1.0 + i * stepSize;
-        r.z = -1.0 + j * stepSize;
-
-        n.y = 1.0;
-        n.x = - A1 * k1 * cosf(k1 * r.x + w1 * t);
-        if (g.waveDim == 2) {
-          r.y = A1 * sinf(k1 * r.x + w1 * t);
-          n.z = 0.0;
-        } else {
-          r.y = A1 * sinf(k1 * r.x + w1 * t) + A2 * sinf(k2 * r.z + w2 * t);
-          n.z = - A2 * k2 * cosf(k2 * r.z + w2 * t);
-        }
+  if (g.drawNormals)
+    drawWaveNormals(tess);
 
-        rEC = glm::vec3(modelViewMatrix * glm::vec4(r, 1.0));
-        nEC = normalMatrix * glm::normalize(n);
-        drawVector(rEC, nEC, 0.05, true, yellow);
-      }
-    }
+  while ((err = glGetError()) != GL_NO_ERROR) {
+    printf("%s %d\n", __FILE__, __LINE__);
+    printf("displaySineWave: %s\n", gluErrorString(err));
   }
+}
+
+/* Draw the sine wave into every view of the multiview at once, one instance
+ * per view, multiview.vert sending each to the viewport (set by the caller)
+ * of its view */
+void drawSineWaveMultiView(int views, glm::mat4* viewMats, glm::mat3* viewNormalMats)
+{
+  // Only CPU lighting depends on the view, and it is excluded by singlePassMultiView()
+  updateVBOs();
+
+  applyMultiViewShading(views, viewMats, viewNormalMats);
+
+  if (g.wireframe)
+    statePolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+  else
+    statePolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+  drawVBOShape(views);
+
+  stateUseProgram(0);
 
   while ((err = glGetError()) != GL_NO_ERROR) {
     printf("%s %d\n", __FILE__, __LINE__);
-    printf("displaySineWave: %s\n", gluErrorString(err));
+    printf("drawSineWaveMultiView: %s\n", gluErrorString(err));
   }
 }
 
@@ -1176,78 +2970,119 @@ void idle()
     g.frameRate = g.frameCount / dt;
     g.lastStatsDisplayT = t;
     g.frameCount = 0;
+    profileSummary(profileCpu, profileGpu);
+    osdChanged();
     if (g.consolePM)
       consolePM();
   }
 
+  checkShaderReload(t);
+
   glutPostRedisplay();
 }
 
 /* ########## DISPLAY BETWEEN MULTIVIEW/SINGLE ########## */
+
+/* The whole multiview can be drawn in one instanced pass (multiview.vert) when
+ * enabled, the shaders draw the wave from VBOs and no colors are lit on the CPU
+ * for a particular view */
+bool singlePassMultiView()
+{
+  return g.singlePass && multiViewProgram && g.vbo && g.wave && g.useShaders &&
+    !(g.lighting && !g.fixed) && !lodMesh() && !tessMesh();
+}
+
 void displayMultiView()
 {
+  glm::mat4 viewMats[NUM_VIEWS];
+  glm::mat3 viewNormalMats[NUM_VIEWS];
+  GLint viewports[NUM_VIEWS][4];
+  bool singlePass = singlePassMultiView();
+  int v;
+
+  // Once for all the views
+  updateWaveBounds();
+  bakeHeightmap();
+  tiles.drawn = tiles.culled = 0;
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glMatrixMode(GL_MODELVIEW);
-  glm::mat4 modelViewMatrixSave(modelViewMatrix);
-  glm::mat3 normalMatrixSave(normalMatrix);
+  if (!g.core)
+    glMatrixMode(GL_MODELVIEW);
 
   // Front view
-  modelViewMatrix = glm::mat4(1.0);
-  glViewport(g.width / 16.0, g.height * 9.0 / 16.0, g.width * 6.0 / 16.0, g.height * 6.0 / 16.0);
-  drawAxes(5.0);
-  if (!g.wave)
-    drawGrid(g.tess);
-  else
-    drawSineWave(g.tess);
-
+  viewMats[0] = glm::mat4(1.0);
+  viewports[0][0] = g.width / 16.0;
+  viewports[0][1] = g.height * 9.0 / 16.0;
 
   // Top view
-  modelViewMatrix = glm::mat4(1.0);
-  modelViewMatrix = glm::rotate(modelViewMatrix, glm::pi<float>() / 2.0f, glm::vec3(1.0, 0.0, 0.0));
-  glViewport(g.width / 16.0, g.height / 16.0, g.width * 6.0 / 16.0, g.height * 6.0 / 16);
-  drawAxes(5.0);
-  if (!g.wave)
-    drawGrid(g.tess);
-  else
-    drawSineWave(g.tess);
+  viewMats[1] = glm::mat4(1.0);
+  viewMats[1] = glm::rotate(viewMats[1], glm::pi<float>() / 2.0f, glm::vec3(1.0, 0.0, 0.0));
+  viewports[1][0] = g.width / 16.0;
+  viewports[1][1] = g.height / 16.0;
 
   // Left view
-  modelViewMatrix = glm::mat4(1.0);
-  modelViewMatrix = glm::rotate(modelViewMatrix, glm::pi<float>() / 2.0f, glm::vec3(0.0, 1.0, 0.0));
-  glViewport(g.width * 9.0 / 16.0, g.height * 9.0 / 16.0, g.width * 6.0 / 16.0, g.height * 6.0 / 16.0);
-  drawAxes(5.0);
-  if (!g.wave)
-    drawGrid(g.tess);
-  else
-    drawSineWave(g.tess);
+  viewMats[2] = glm::mat4(1.0);
+  viewMats[2] = glm::rotate(viewMats[2], glm::pi<float>() / 2.0f, glm::vec3(0.0, 1.0, 0.0));
+  viewports[2][0] = g.width * 9.0 / 16.0;
+  viewports[2][1] = g.height * 9.0 / 16.0;
 
   // General view
-  modelViewMatrix = glm::rotate(modelViewMatrix, camera.rotateX * glm::pi<float>() / 180.0f, glm::vec3(1.0, 0.0, 0.0));
-  modelViewMatrix = glm::rotate(modelViewMatrix, camera.rotateY * glm::pi<float>() / 180.0f, glm::vec3(0.0, 1.0, 0.0));
-  modelViewMatrix = glm::scale(modelViewMatrix, glm::vec3(camera.scale));
-  normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelViewMatrix)));
-  glViewport(g.width * 9.0 / 16.0, g.width / 16.0, g.width * 6.0 / 16.0, g.height * 6.0 / 16.0);
-  drawAxes(5.0);
-  if (!g.wave)
-    drawGrid(g.tess);
-  else
-    drawSineWave(g.tess);
+  viewMats[3] = glm::rotate(viewMats[2], camera.rotateX * glm::pi<float>() / 180.0f, glm::vec3(1.0, 0.0, 0.0));
+  viewMats[3] = glm::rotate(viewMats[3], camera.rotateY * glm::pi<float>() / 180.0f, glm::vec3(0.0, 1.0, 0.0));
+  viewMats[3] = glm::scale(viewMats[3], glm::vec3(camera.scale));
+  viewports[3][0] = g.width * 9.0 / 16.0;
+  viewports[3][1] = g.width / 16.0;
+
+  for (v = 0; v < NUM_VIEWS; v++) {
+    viewNormalMats[v] = glm::transpose(glm::inverse(glm::mat3(viewMats[v])));
+    viewports[v][2] = g.width * 6.0 / 16.0;
+    viewports[v][3] = g.height * 6.0 / 16.0;
+  }
+
+  for (v = 0; v < NUM_VIEWS; v++) {
+    modelViewMatrix = viewMats[v];
+    normalMatrix = viewNormalMats[v];
+    shading.slot = v;
+    stateViewport(viewports[v][0], viewports[v][1], viewports[v][2], viewports[v][3]);
+    drawAxes(5.0);
+    if (singlePass) {
+      if (g.drawNormals)
+        drawWaveNormals(g.tess);
+    }
+    else if (!g.wave)
+      drawGrid(g.tess);
+    else
+      drawSineWave(g.tess);
+  }
+
+  // One draw for all views, each with its own viewport
+  if (singlePass) {
+    for (v = 0; v < NUM_VIEWS; v++)
+      stateViewportIndexedf(v, viewports[v][0], viewports[v][1], viewports[v][2], viewports[v][3]);
+    drawSineWaveMultiView(NUM_VIEWS, viewMats, viewNormalMats);
+    // Leave the general view's viewport, used by the OSD
+    stateViewport(viewports[3][0], viewports[3][1], viewports[3][2], viewports[3][3]);
+  }
 
   if (g.displayOSD)
     displayOSD();
 
   g.frameCount++;
 
-  glutSwapBuffers();
-
+  swapBuffers();
+  profileFrame();
+  stateFrame();
 }
 
 void display()
 {
+  updateWaveBounds();
+  bakeHeightmap();
+  tiles.drawn = tiles.culled = 0;
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glMatrixMode(GL_MODELVIEW);
+  if (!g.core)
+    glMatrixMode(GL_MODELVIEW);
 
-  glViewport(0, 0, g.width, g.height);
+  stateViewport(0, 0, g.width, g.height);
 
   // General view
   modelViewMatrix = glm::mat4(1.0);
@@ -1258,6 +3093,7 @@ void display()
   modelViewMatrix = glm::scale(modelViewMatrix, glm::vec3(camera.scale));
 
   normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelViewMatrix)));
+  shading.slot = 0;
 
   if (debug[d_matrices]) {
     printf("modelViewMatrix\n");
@@ -1275,7 +3111,9 @@ void display()
   if (g.displayOSD)
     displayOSD();
 
-  glutSwapBuffers();
+  swapBuffers();
+  profileFrame();
+  stateFrame();
 
   g.frameCount++;
 
@@ -1292,11 +3130,14 @@ void keyboard(unsigned char key, int x, int y)
    * 1. Frame related information
    * 2. Flags (that have been set/unset)
    * 3. Values (shininess, tesselation, dimension for sine wave)
+   * 4. Profile (per stage cpu/gpu times)
    */
-  const char* osd[] = { "FRAME", "FLAGS", "VALUES" };
+  const char* osd[] = { "FRAME", "FLAGS", "VALUES", "PROFILE" };
+  unsigned change = c_ui;
 
   switch (key) {
   case 27: //quit
+    profileShutdown();
     printf("exit\n");
     exit(0);
     break;
@@ -1308,69 +3149,126 @@ void keyboard(unsigned char key, int x, int y)
       }
     }
     printf("animation: %s\n", g.animate?"true":"false");
+    change = c_ui;
     break;
   case 'b': //smooth/flat shading
     g.flat = !g.flat;
     printf("flat: %s\n", g.flat?"true":"false");
+    change = c_uniform;
     break;
   case 'c': //console display
     g.consolePM = !g.consolePM;
     g.displayOSD = !g.displayOSD;
     printf("console: %s\n", g.consolePM?"true":"false");
+    change = c_ui;
     break;
   case 'd': //directional/positional lighting
     g.positional = !g.positional;
     printf("positional: %s\n", g.positional?"true":"false");
+    change = c_lighting;
+    break;
+  case 'e': //patches subdivided by tessellation shaders
+    g.tessShader = !g.tessShader;
+    printf("tess shaders: %s\n", g.tessShader?"true":"false");
+    change = c_geometry;
     break;
   case 'f': //gpu/cpu lighting
     g.fixed = !g.fixed;
     printf("fixed: %s\n", g.fixed?"true":"false");
+    change = c_geometry;
     break;
   case 'g': //shaders
+    if (g.core) {
+      printf("shaders: required by the core profile\n");
+      break;
+    }
     g.useShaders = !g.useShaders;
     printf("shaders: %s\n", g.useShaders?"true":"false");
+    change = c_geometry;
     break;
   case 'H': //increase shininess
     g.shininess += 5.0;
     if (g.shininess > 125.0)
       g.shininess = 125.0;
     printf("shininess: %.1f\n", g.shininess);
+    change = c_lighting;
     break;
   case 'h': //decrease shininess
     g.shininess -= 5.0;
     if (g.shininess < 5.0)
       g.shininess = 5.0;
     printf("shininess: %.1f\n", g.shininess);
+    change = c_lighting;
+    break;
+  case 'i': //single pass (instanced) multiview
+    g.singlePass = !g.singlePass;
+    if (g.singlePass && !multiViewProgram)
+      printf("single pass: unsupported, needs ARB_shader_viewport_layer_array\n");
+    printf("single pass: %s\n", g.singlePass?"true":"false");
+    change = c_ui;
+    break;
+  case 'k': //cull the VBO mesh's tiles outside the view
+    g.cull = !g.cull;
+    printf("cull: %s\n", g.cull?"true":"false");
+    change = c_uniform;
     break;
   case 'l': //lighting
     g.lighting = !g.lighting;
     printf("lighting: %s\n", g.lighting?"true":"false");
+    change = c_geometry;
     break;
   case 'm': //specular lighting mode (Blinn-Phong/Phong)
     g.phong = !g.phong;
     printf("phong: %s\n", g.phong?"true":"false");
+    change = c_lighting;
     break;
   case 'n': //normals
     g.drawNormals = !g.drawNormals;
     printf("normals: %s\n", g.drawNormals?"true":"false");
+    change = c_ui;
     break;
   case 'o': // cycle OSD options (enum)
     g.option = static_cast<OSD>(g.option+1);
-    if (g.option > VALUES)
+    if (g.option > PROFILE)
       g.option = FRAME;
     printf("osd: %s\n", osd[g.option]);
+    change = c_ui;
     break;
   case 'p': //per (vertex/pixel) lighting
     g.perPixel = !g.perPixel;
     printf("per pixel: %s\n", g.perPixel?"true":"flase");
+    change = c_uniform;
+    break;
+  case 'q': //quadtree LOD chunks in place of the g.tess grid
+    g.lod = !g.lod;
+    printf("lod: %s\n", g.lod?"true":"false");
+    change = c_geometry;
+    break;
+  case 'r': //record a chrome trace of the profiled stages
+    if (profileTracing())
+      profileTraceStop();
+    else if (!profileTraceStart(traceFile))
+      printf("trace: unable to open %s\n", traceFile);
+    printf("trace: %s\n", profileTracing()?traceFile:"stopped");
+    change = c_ui;
     break;
   case 's': //shape change
     g.wave = !g.wave;
     if (!g.wave)
       g.animate = false;
     printf("wave: %s\n", g.wave?"true":"false");
+    change = c_geometry;
+    break;
+  case 't': //triangle strip/list indices for VBOs
+    g.strips = !g.strips;
+    printf("strips: %s\n", g.strips?"true":"false");
+    change = c_uniform;
     break;
   case 'v': //VBO mode
+    if (g.core) {
+      printf("vbo: required by the core profile\n");
+      break;
+    }
     g.vbo = !g.vbo;
     //assumes vbo is initally off: initalize and bind (if default on, use resetVBOS())
     if (g.vbo) {
@@ -1380,16 +3278,30 @@ void keyboard(unsigned char key, int x, int y)
     else
       unbindVBOs();
     printf("vbo: %s\n", g.vbo?"true":"false");
+    change = c_geometry;
     break;
   case 'w': //wireframe
     g.wireframe = !g.wireframe;
     printf("wireframe: %s\n", g.wireframe?"true":"false");
+    change = c_uniform;
+    break;
+  case 'x': //mesh from gl_VertexID, without vertex buffers
+    g.vertexId = !g.vertexId;
+    printf("vertex id: %s\n", g.vertexId?"true":"false");
+    change = c_geometry;
     break;
-  case 'z': //2D/3D wave
+  case 'y': //wave baked into a heightmap the shaders read
+    g.heightmap = !g.heightmap;
+    printf("heightmap: %s\n", g.heightmap?"true":"false");
+    change = c_geometry;
+    break;
+  case 'z': //2D/3D wave, Gerstner wave spectrum, FFT ocean
     g.waveDim++;
-    if (g.waveDim > 3)
+    if (g.waveDim > 5)
       g.waveDim = 2;
-    printf("dimension: %d\n", g.waveDim);
+    printf("dimension: %d%s\n", g.waveDim, g.waveDim == 4 ? " (spectrum)" :
+      g.waveDim == 5 ? " (ocean)" : "");
+    change = c_geometry;
     break;
   case '4': //multiview
     g.multiView = !g.multiView;
@@ -1398,23 +3310,27 @@ void keyboard(unsigned char key, int x, int y)
     else
       glutDisplayFunc(display);
     printf("multiview: %s\n", g.multiView?"true":"false");
+    change = c_ui;
     break;
   case '+': //increase tesselation
     g.tess *= 2;
     printf("tesselation: %d\n", g.tess);
+    change = c_geometry;
     break;
   case '-': //decrease tesselation
     g.tess /= 2;
     if (g.tess < 8)
       g.tess = 8;
     printf("tesselation: %d\n", g.tess);
+    change = c_geometry;
     break;
   default:
     break;
   }
 
-  if (g.vbo)  // Recalculate VBOs due to mode change
-    resetVBOS();
+  // VBOs are recalculated on the next draw only if they depend on the change
+  markChanged(change);
+  osdChanged();
   glutPostRedisplay();
 }
 
@@ -1471,21 +3387,428 @@ void motion(int x, int y)
     break;
   }
 
-  if(g.vbo) // When vbos on, recalculate when moving camera around
-    resetVBOS();
-
+  // When vbos on, the next draw recalculates them if they depend on the camera
   glutPostRedisplay();
 }
 
+/* ########## HEADLESS BENCHMARK ########## */
+/* Sweeps every render path and tesselation level on an offscreen (EGL
+ * surfaceless) context, e.g. Mesa llvmpipe, and writes frame time
+ * statistics to a CSV file. Run as:
+ *   ./sinewave --bench [--frames n] [--warmup n] [--min-tess n]
+ *                      [--max-tess n] [--size wxh] [--threads n]
+ *                      [--orphan] [--strips] [--single-pass] [--core]
+ *                      [--uber-shader] [--vertex-id] [--lod] [--scale s]
+ *                      [--tess-shader] [--no-cull] [--spectrum]
+ *                      [--waves n] [--ocean] [--ocean-size n]
+ *                      [--heightmap] [--heightmap-size n]
+ *                      [--no-program-cache]
+ *                      [--trace file.json] [--out file.csv]
+ */
+typedef enum {
+  b_vbo,
+  b_shaders,
+  b_fixed,
+  b_perPixel,
+  b_dim3,
+  b_animate,
+  b_nflags
+} BenchFlags;
+
+typedef struct {
+  int frames;          // measured frames per configuration
+  int warmup;          // discarded frames before measuring
+  int minTess, maxTess;
+  float dt;            // animation time step per frame (seconds)
+  const char* output;
+  const char* trace;   // chrome trace of the whole sweep, NULL for none
+  int width, height;   // offscreen framebuffer size
+  bool orphan;         // stream vertices by orphaning even if buffer storage exists
+  bool spectrum;       // the 3D configurations draw the spectrum (dimension 4)
+  bool ocean;          // or the ocean (dimension 5)
+  EGLDisplay display;
+  EGLContext context;
+  GLuint fbo, colorRb, depthRb;
+} Bench;
+
+Bench bench =
+{
+  30,          // frames
+  3,           // warmup
+  8,           // minTess
+  2048,        // maxTess
+  1.0 / 60.0,  // dt
+  "bench.csv", // output
+  NULL,        // trace
+  1024,        // width
+  1024,        // height
+  false,       // orphan
+  false,       // spectrum
+  false,       // ocean
+  EGL_NO_DISPLAY,
+  EGL_NO_CONTEXT,
+  0, 0, 0
+};
+
+double benchTime()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * milli + ts.tv_nsec / 1.0e6;
+}
+
+int compareFloat(const void* a, const void* b)
+{
+  float fa = *(const float*) a, fb = *(const float*) b;
+  return (fa > fb) - (fa < fb);
+}
+
+// Nearest-rank percentile of an already sorted array
+float percentile(float* sorted, int n, float p)
+{
+  int rank = (int) ceilf(p / 100.0 * n);
+  if (rank < 1)
+    rank = 1;
+  return sorted[rank - 1];
+}
+
+bool benchInitContext()
+{
+  // Prefer the surfaceless platform so no display server is needed
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+    (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (getPlatformDisplay)
+    bench.display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+  if (bench.display == EGL_NO_DISPLAY)
+    bench.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+  EGLint major, minor;
+  if (!eglInitialize(bench.display, &major, &minor)) {
+    printf("bench: unable to initialize EGL\n");
+    return false;
+  }
+  eglBindAPI(EGL_OPENGL_API);
+
+  // Rendering goes to an FBO so no surface (and thus no config) is required
+  EGLint coreAttribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+  bench.context = eglCreateContext(bench.display, (EGLConfig) 0, EGL_NO_CONTEXT,
+    g.core ? coreAttribs : NULL);
+  if (bench.context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(bench.display, EGL_NO_SURFACE, EGL_NO_SURFACE, bench.context)) {
+    printf("bench: unable to create a surfaceless OpenGL context\n");
+    return false;
+  }
+  printf("bench: EGL %d.%d, %s, %s\n", major, minor,
+    glGetString(GL_RENDERER), glGetString(GL_VERSION));
+  stateReset();
+
+  glGenRenderbuffers(1, &bench.colorRb);
+  glBindRenderbuffer(GL_RENDERBUFFER, bench.colorRb);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, bench.width, bench.height);
+  glGenRenderbuffers(1, &bench.depthRb);
+  glBindRenderbuffer(GL_RENDERBUFFER, bench.depthRb);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, bench.width, bench.height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &bench.fbo);
+  stateBindFramebuffer(GL_FRAMEBUFFER, bench.fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, bench.colorRb);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, bench.depthRb);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    printf("bench: offscreen framebuffer incomplete\n");
+    return false;
+  }
+  glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+  return true;
+}
+
+void benchDestroyContext()
+{
+  stateDeleteFramebuffers(1, &bench.fbo);
+  glDeleteRenderbuffers(1, &bench.colorRb);
+  glDeleteRenderbuffers(1, &bench.depthRb);
+  eglMakeCurrent(bench.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroyContext(bench.display, bench.context);
+  eglTerminate(bench.display);
+}
+
+bool benchParseArgs(int argc, char** argv)
+{
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--orphan") == 0) {
+      bench.orphan = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--single-pass") == 0) {
+      g.singlePass = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--strips") == 0) {
+      g.strips = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--core") == 0) {
+      g.core = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--uber-shader") == 0) {
+      g.uberShader = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--vertex-id") == 0) {
+      g.vertexId = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--lod") == 0) {
+      g.lod = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--tess-shader") == 0) {
+      g.tessShader = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--no-cull") == 0) {
+      g.cull = false;
+      continue;
+    }
+    if (strcmp(argv[i], "--spectrum") == 0) {
+      bench.spectrum = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--ocean") == 0) {
+      bench.ocean = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--heightmap") == 0) {
+      g.heightmap = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--no-program-cache") == 0) {
+      programCacheDir = NULL;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      printf("bench: missing value for %s\n", argv[i]);
+      return false;
+    }
+    if (strcmp(argv[i], "--frames") == 0)
+      bench.frames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--warmup") == 0)
+      bench.warmup = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--min-tess") == 0)
+      bench.minTess = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--max-tess") == 0)
+      bench.maxTess = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--size") == 0) {
+      if (sscanf(argv[++i], "%dx%d", &bench.width, &bench.height) != 2) {
+        printf("bench: size must be given as wxh\n");
+        return false;
+      }
+    }
+    else if (strcmp(argv[i], "--scale") == 0)
+      camera.scale = atof(argv[++i]);
+    else if (strcmp(argv[i], "--threads") == 0)
+      setWorkerThreads(atoi(argv[++i]));
+    else if (strcmp(argv[i], "--waves") == 0)
+      g.waves = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--ocean-size") == 0)
+      g.oceanSize = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--heightmap-size") == 0)
+      g.heightmapSize = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--out") == 0)
+      bench.output = argv[++i];
+    else if (strcmp(argv[i], "--trace") == 0)
+      bench.trace = argv[++i];
+    else {
+      printf("bench: unknown option %s\n", argv[i]);
+      return false;
+    }
+  }
+  if (bench.frames < 1 || bench.warmup < 0 || bench.minTess < 1 ||
+      bench.maxTess < bench.minTess || bench.width < 1 || bench.height < 1 ||
+      camera.scale <= 0.0 || g.waves < 1 || g.waves > SPECTRUM_MAX_WAVES ||
+      g.oceanSize < OCEAN_MIN_SIZE || g.oceanSize > OCEAN_MAX_SIZE || (g.oceanSize & (g.oceanSize - 1)) ||
+      g.heightmapSize < HEIGHTMAP_MIN_SIZE || g.heightmapSize > HEIGHTMAP_MAX_SIZE) {
+    printf("bench: invalid frame/tesselation/size/scale/waves/ocean/heightmap size range\n");
+    return false;
+  }
+  return true;
+}
+
+// Render one configuration, returns false if the output file failed
+bool benchConfig(FILE* out, float* samples)
+{
+  // Settings were changed directly rather than by keyboard()
+  osdChanged();
+
+  // Same sequence as toggling 'v' in keyboard()
+  if (g.vbo) {
+    initVBOs();
+    bindVBOs();
+  }
+
+  g.t = 0.0;
+  int issued = 0, elided = 0;
+  for (int f = -bench.warmup; f < bench.frames; f++) {
+    double start = benchTime();
+    if (g.multiView)
+      displayMultiView();
+    else
+      display();
+    double end = benchTime();
+
+    if (f >= 0) {
+      int i, e;
+      samples[f] = end - start;
+      stateCounts(&i, &e);
+      issued += i;
+      elided += e;
+    }
+    if (g.animate)
+      g.t += bench.dt;
+  }
+
+  if (g.vbo)
+    unbindVBOs();
+
+  float mean = 0.0;
+  for (int f = 0; f < bench.frames; f++)
+    mean += samples[f];
+  mean /= bench.frames;
+  qsort(samples, bench.frames, sizeof(float), compareFloat);
+  float p50 = percentile(samples, bench.frames, 50.0);
+  float p99 = percentile(samples, bench.frames, 99.0);
+
+  printf("multiview %d tess %4d vbo %d shaders %d fixed %d perpixel %d dim %d animate %d:"
+    " mean %8.3f p50 %8.3f p99 %8.3f ms, state calls/f %3d issued %3d elided\n",
+    g.multiView, g.tess, g.vbo, g.useShaders, g.fixed, g.perPixel, g.waveDim, g.animate,
+    mean, p50, p99, issued / bench.frames, elided / bench.frames);
+  fflush(stdout);
+
+  return fprintf(out, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%.4f,%.4f,%.4f\n",
+    g.multiView, g.tess, g.vbo, g.useShaders, g.fixed, g.perPixel, g.waveDim, g.animate,
+    bench.frames, mean, p50, p99) > 0;
+}
+
+int benchMain(int argc, char** argv)
+{
+  if (!benchParseArgs(argc, argv) || !benchInitContext())
+    return 1;
+
+  FILE* out = fopen(bench.output, "w");
+  if (!out) {
+    printf("bench: unable to open %s\n", bench.output);
+    benchDestroyContext();
+    return 1;
+  }
+  fprintf(out, "multiview,tess,vbo,shaders,fixed,perpixel,dim,animate,frames,mean_ms,p50_ms,p99_ms\n");
+
+  // OSD is left off: it needs a GLUT window and isn't what is being measured
+  g.headless = true;
+  g.displayOSD = false;
+  g.consolePM = false;
+  g.wave = true;
+
+  init();
+  reshape(bench.width, bench.height);
+  if (bench.orphan) {
+    stream.persistent = false;
+    printf("vertex stream: orphaning (forced)\n");
+  }
+
+  if (bench.trace && !profileTraceStart(bench.trace)) {
+    printf("bench: unable to open %s\n", bench.trace);
+    fclose(out);
+    benchDestroyContext();
+    return 1;
+  }
+
+  float* samples = (float*) calloc(bench.frames, sizeof(float));
+  bool ok = true;
+  for (int multiView = 0; multiView <= 1 && ok; multiView++) {
+    for (int tess = bench.minTess; tess <= bench.maxTess && ok; tess *= 2) {
+      for (int mask = 0; mask < (1 << b_nflags) && ok; mask++) {
+        g.multiView = multiView;
+        g.tess = tess;
+        g.vbo = mask & (1 << b_vbo);
+        g.useShaders = mask & (1 << b_shaders);
+        g.fixed = mask & (1 << b_fixed);
+        g.perPixel = mask & (1 << b_perPixel);
+        g.waveDim = (mask & (1 << b_dim3)) ? (bench.ocean ? 5 : bench.spectrum ? 4 : 3) : 2;
+        g.animate = mask & (1 << b_animate);
+        // Immediate mode and the fixed pipeline don't exist in the core profile
+        if (g.core && !(g.vbo && g.useShaders))
+          continue;
+        ok = benchConfig(out, samples);
+      }
+    }
+  }
+  free(samples);
+
+  if (fclose(out) != 0 || !ok) {
+    printf("bench: error writing %s\n", bench.output);
+    ok = false;
+  }
+  else
+    printf("bench: results written to %s\n", bench.output);
+
+  if (bench.trace)
+    printf("bench: trace written to %s\n", bench.trace);
+  profileShutdown();
+  glDeleteProgram(shaderProgram);
+  glDeleteProgram(multiViewProgram);
+  releaseShaderVariants();
+  glDeleteProgram(normalsProgram);
+  glDeleteProgram(tessProgram);
+  glDeleteProgram(linesProgram);
+  glDeleteProgram(heightmapProgram);
+  releaseShadingState();
+  releaseIndexCache();
+  releaseTileRuns();
+  stateDeleteVertexArrays(1, &emptyVao);
+  benchDestroyContext();
+  return ok ? 0 : 1;
+}
+
 /* ########## MAIN ########## */
 int main(int argc, char** argv)
 {
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    return benchMain(argc, argv);
+
+  // The core profile renderer needs its own context, so is chosen at startup
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--core") == 0)
+      g.core = true;
+    if (strcmp(argv[i], "--no-program-cache") == 0)
+      programCacheDir = NULL;
+  }
+
   glutInit(&argc, argv);
+  if (g.core) {
+    glutInitContextVersion(3, 3);
+    glutInitContextProfile(GLUT_CORE_PROFILE);
+  }
   glutInitDisplayMode (GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
   glutInitWindowSize (1024, 1024);
   glutInitWindowPosition (100, 100);
   glutCreateWindow (argv[0]);
+  stateReset();
   init();
+  watchShaders();
+  if (g.core) {
+    // Immediate mode and the fixed pipeline don't exist in the core profile
+    g.vbo = true;
+    g.useShaders = true;
+    initVBOs();
+    bindVBOs();
+  }
   glutDisplayFunc(display);
   glutReshapeFunc(reshape);
   glutIdleFunc(idle);
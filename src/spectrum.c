@@ -0,0 +1,334 @@
+/* Gerstner wave spectrum, scalar reference plus SSE/AVX2 kernels */
+
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#	define SPECTRUM_X86 1
+#	include <immintrin.h>
+#endif
+
+#include "spectrum.h"
+
+typedef void (*SpectrumKernel)(const WaveSpectrum* spectrum, float t, int n,
+  const float* x, const float* z,
+  float* px, float* py, float* pz,
+  float* nx, float* ny, float* nz);
+
+/* Directions spread this far either side of the x axis (radians) and the
+ * steepness sum(Q k A) of the whole spectrum, below 1 so crests don't loop */
+#define SPREAD 1.0f
+#define STEEPNESS 0.6f
+#define TWO_PI 6.28318530717959f
+
+/* Same sequence on every platform, so every run draws the same sea */
+static float random01(unsigned* seed)
+{
+  *seed = *seed * 1664525u + 1013904223u;
+  return (float) (*seed >> 8) / 16777216.0f;
+}
+
+void makeSpectrum(WaveSpectrum* spectrum, int count, float amplitude, float wavelength)
+{
+  const float pi = 3.14159265358979f;
+  unsigned seed = 1;
+  float sum = 0.0f;
+  int i;
+
+  if (count > SPECTRUM_MAX_WAVES)
+    count = SPECTRUM_MAX_WAVES;
+  spectrum->count = count;
+
+  for (i = 0; i < count; i++) {
+    GerstnerWave* w = &spectrum->waves[i];
+    /* wavelengths from wavelength down to an eighth of it, geometrically,
+     * the amplitude proportional to the wavelength so each is as steep, and
+     * scaled so the sea is on average as high as a sine of amplitude */
+    float length = wavelength * powf(0.125f, count > 1 ? (float) i / (count - 1) : 0.0f);
+    float angle = (2.0f * random01(&seed) - 1.0f) * SPREAD;
+
+    w->dirX = cosf(angle);
+    w->dirZ = sinf(angle);
+    w->k = 2.0f * pi / length;
+    w->amplitude = length;
+    /* deep water dispersion, speed ~ sqrt(k), the longest as fast as the sines */
+    w->speed = 0.25f * sqrtf(wavelength / length);
+    w->phase = 2.0f * pi * random01(&seed);
+    sum += length * length;
+  }
+  for (i = 0; i < count; i++) {
+    GerstnerWave* w = &spectrum->waves[i];
+    w->amplitude *= amplitude / sqrtf(sum);
+    w->steepness = STEEPNESS / (w->k * w->amplitude * count);
+  }
+}
+
+/* speed t + phase of a wave, reduced to [0, 2 pi) so theta stays within the
+ * range of sincosSSE()/sincosAVX2() however long the wave has run, as
+ * spectrumSums() in common.glsl does */
+static float wavePhase(const GerstnerWave* w, float t)
+{
+  return fmodf(w->speed * t + w->phase, TWO_PI);
+}
+
+/* Each point moves by sum(Q A D cos(theta)) sideways and sum(A sin(theta)) up,
+ * theta = k D.(x, z) + speed t + phase. The normal is the cross product of
+ * the surface's derivatives along z and x, from the sums
+ *   Sxx, Sxz, Szz = sum(Q A k D D sin(theta)), Cx, Cz = sum(A k D cos(theta)).
+ */
+static void spectrumScalar(const WaveSpectrum* spectrum, float t, int n,
+  const float* x, const float* z,
+  float* px, float* py, float* pz,
+  float* nx, float* ny, float* nz)
+{
+  int i, j;
+
+  for (i = 0; i < n; i++) {
+    float dx = 0.0f, dy = 0.0f, dz = 0.0f;
+    float Sxx = 0.0f, Sxz = 0.0f, Szz = 0.0f, Cx = 0.0f, Cz = 0.0f;
+
+    for (j = 0; j < spectrum->count; j++) {
+      const GerstnerWave* w = &spectrum->waves[j];
+      float theta = w->k * (w->dirX * x[i] + w->dirZ * z[i]) + wavePhase(w, t);
+      float s = sinf(theta), c = cosf(theta);
+      float qa = w->steepness * w->amplitude, ak = w->amplitude * w->k;
+      float qaks = qa * w->k * s;
+
+      dx += qa * w->dirX * c;
+      dz += qa * w->dirZ * c;
+      dy += w->amplitude * s;
+      Sxx += qaks * w->dirX * w->dirX;
+      Sxz += qaks * w->dirX * w->dirZ;
+      Szz += qaks * w->dirZ * w->dirZ;
+      Cx += ak * w->dirX * c;
+      Cz += ak * w->dirZ * c;
+    }
+
+    px[i] = x[i] + dx;
+    py[i] = dy;
+    pz[i] = z[i] + dz;
+    nx[i] = -Sxz * Cz - (1.0f - Szz) * Cx;
+    ny[i] = (1.0f - Sxx) * (1.0f - Szz) - Sxz * Sxz;
+    nz[i] = -Sxz * Cx - (1.0f - Sxx) * Cz;
+  }
+}
+
+#ifdef SPECTRUM_X86
+/* sin and cos of x (|x| < 8192, see wavePhase()) with the Cephes sinf/cosf polynomials
+ * (error ~1e-7), x reduced to [-pi/4, pi/4] by its octant j. With x = r + m
+ * pi/2 (j = 2m), sin(x) is sin(r), cos(r), -sin(r), -cos(r) for m = 0..3 and
+ * cos(x) is cos(r), -sin(r), -cos(r), sin(r). */
+#define DP1 0.78515625f
+#define DP2 2.4187564849853515625e-4f
+#define DP3 3.77489497744594108e-8f
+#define FOUR_OVER_PI 1.27323954473516f
+
+#define SIN_POLY(P, r, z, MUL, ADD, SET) \
+  P = SET(-1.9515295891E-4f); \
+  P = ADD(MUL(P, z), SET(8.3321608736E-3f)); \
+  P = ADD(MUL(P, z), SET(-1.6666654611E-1f)); \
+  P = ADD(MUL(MUL(P, z), r), r)
+
+#define COS_POLY(P, z, MUL, ADD, SUB, SET) \
+  P = SET(2.443315711809948E-5f); \
+  P = ADD(MUL(P, z), SET(-1.388731625493765E-3f)); \
+  P = ADD(MUL(P, z), SET(4.166664568298827E-2f)); \
+  P = ADD(SUB(MUL(MUL(P, z), z), MUL(z, SET(0.5f))), SET(1.0f))
+
+static void sincosSSE(__m128 x, __m128* sinx, __m128* cosx)
+{
+  const __m128 signBit = _mm_set1_ps(-0.0f);
+  __m128 sign = _mm_and_ps(x, signBit);
+  x = _mm_andnot_ps(signBit, x);
+
+  __m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(FOUR_OVER_PI)));
+  j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+  __m128 y = _mm_cvtepi32_ps(j);
+  x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(DP1)));
+  x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(DP2)));
+  x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(DP3)));
+
+  __m128 z = _mm_mul_ps(x, x), s, c;
+  SIN_POLY(s, x, z, _mm_mul_ps, _mm_add_ps, _mm_set1_ps);
+  COS_POLY(c, z, _mm_mul_ps, _mm_add_ps, _mm_sub_ps, _mm_set1_ps);
+
+  /* m odd swaps them, the signs follow from m (and x's for the sine) */
+  __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(
+    _mm_and_si128(j, _mm_set1_epi32(2)), _mm_set1_epi32(2)));
+  __m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29));
+  __m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(
+    _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+  __m128 sr = _mm_or_ps(_mm_andnot_ps(swap, s), _mm_and_ps(swap, c));
+  __m128 cr = _mm_or_ps(_mm_andnot_ps(swap, c), _mm_and_ps(swap, s));
+
+  *sinx = _mm_xor_ps(sr, _mm_xor_ps(sinSign, sign));
+  *cosx = _mm_xor_ps(cr, cosSign);
+}
+
+static void spectrumSSE(const WaveSpectrum* spectrum, float t, int n,
+  const float* x, const float* z,
+  float* px, float* py, float* pz,
+  float* nx, float* ny, float* nz)
+{
+  const __m128 one = _mm_set1_ps(1.0f);
+  int i, j;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m128 X = _mm_loadu_ps(x + i), Z = _mm_loadu_ps(z + i);
+    __m128 dx = _mm_setzero_ps(), dy = dx, dz = dx;
+    __m128 Sxx = dx, Sxz = dx, Szz = dx, Cx = dx, Cz = dx;
+
+    for (j = 0; j < spectrum->count; j++) {
+      const GerstnerWave* w = &spectrum->waves[j];
+      __m128 theta = _mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(X, _mm_set1_ps(w->k * w->dirX)), _mm_mul_ps(Z, _mm_set1_ps(w->k * w->dirZ))),
+        _mm_set1_ps(wavePhase(w, t)));
+      __m128 s, c;
+      sincosSSE(theta, &s, &c);
+
+      float qa = w->steepness * w->amplitude, ak = w->amplitude * w->k, qak = qa * w->k;
+      dx = _mm_add_ps(dx, _mm_mul_ps(c, _mm_set1_ps(qa * w->dirX)));
+      dz = _mm_add_ps(dz, _mm_mul_ps(c, _mm_set1_ps(qa * w->dirZ)));
+      dy = _mm_add_ps(dy, _mm_mul_ps(s, _mm_set1_ps(w->amplitude)));
+      Sxx = _mm_add_ps(Sxx, _mm_mul_ps(s, _mm_set1_ps(qak * w->dirX * w->dirX)));
+      Sxz = _mm_add_ps(Sxz, _mm_mul_ps(s, _mm_set1_ps(qak * w->dirX * w->dirZ)));
+      Szz = _mm_add_ps(Szz, _mm_mul_ps(s, _mm_set1_ps(qak * w->dirZ * w->dirZ)));
+      Cx = _mm_add_ps(Cx, _mm_mul_ps(c, _mm_set1_ps(ak * w->dirX)));
+      Cz = _mm_add_ps(Cz, _mm_mul_ps(c, _mm_set1_ps(ak * w->dirZ)));
+    }
+
+    __m128 ux = _mm_sub_ps(one, Sxx), uz = _mm_sub_ps(one, Szz);
+    _mm_storeu_ps(px + i, _mm_add_ps(X, dx));
+    _mm_storeu_ps(py + i, dy);
+    _mm_storeu_ps(pz + i, _mm_add_ps(Z, dz));
+    _mm_storeu_ps(nx + i, _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(_mm_mul_ps(Sxz, Cz), _mm_mul_ps(uz, Cx))));
+    _mm_storeu_ps(ny + i, _mm_sub_ps(_mm_mul_ps(ux, uz), _mm_mul_ps(Sxz, Sxz)));
+    _mm_storeu_ps(nz + i, _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(_mm_mul_ps(Sxz, Cx), _mm_mul_ps(ux, Cz))));
+  }
+
+  spectrumScalar(spectrum, t, n - i, x + i, z + i, px + i, py + i, pz + i, nx + i, ny + i, nz + i);
+}
+
+#define AVX2 __attribute__((target("avx2,fma")))
+
+AVX2 static void sincosAVX2(__m256 x, __m256* sinx, __m256* cosx)
+{
+  const __m256 signBit = _mm256_set1_ps(-0.0f);
+  __m256 sign = _mm256_and_ps(x, signBit);
+  x = _mm256_andnot_ps(signBit, x);
+
+  __m256i j = _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(FOUR_OVER_PI)));
+  j = _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+  __m256 y = _mm256_cvtepi32_ps(j);
+  x = _mm256_fnmadd_ps(y, _mm256_set1_ps(DP1), x);
+  x = _mm256_fnmadd_ps(y, _mm256_set1_ps(DP2), x);
+  x = _mm256_fnmadd_ps(y, _mm256_set1_ps(DP3), x);
+
+  __m256 z = _mm256_mul_ps(x, x), s, c;
+  SIN_POLY(s, x, z, _mm256_mul_ps, _mm256_add_ps, _mm256_set1_ps);
+  COS_POLY(c, z, _mm256_mul_ps, _mm256_add_ps, _mm256_sub_ps, _mm256_set1_ps);
+
+  __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+    _mm256_and_si256(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(2)));
+  __m256 sinSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(j, _mm256_set1_epi32(4)), 29));
+  __m256 cosSign = _mm256_castsi256_ps(_mm256_slli_epi32(
+    _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29));
+
+  *sinx = _mm256_xor_ps(_mm256_blendv_ps(s, c, swap), _mm256_xor_ps(sinSign, sign));
+  *cosx = _mm256_xor_ps(_mm256_blendv_ps(c, s, swap), cosSign);
+}
+
+AVX2 static void spectrumAVX2(const WaveSpectrum* spectrum, float t, int n,
+  const float* x, const float* z,
+  float* px, float* py, float* pz,
+  float* nx, float* ny, float* nz)
+{
+  const __m256 one = _mm256_set1_ps(1.0f);
+  int i, j;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m256 X = _mm256_loadu_ps(x + i), Z = _mm256_loadu_ps(z + i);
+    __m256 dx = _mm256_setzero_ps(), dy = dx, dz = dx;
+    __m256 Sxx = dx, Sxz = dx, Szz = dx, Cx = dx, Cz = dx;
+
+    for (j = 0; j < spectrum->count; j++) {
+      const GerstnerWave* w = &spectrum->waves[j];
+      __m256 theta = _mm256_fmadd_ps(X, _mm256_set1_ps(w->k * w->dirX),
+        _mm256_fmadd_ps(Z, _mm256_set1_ps(w->k * w->dirZ), _mm256_set1_ps(wavePhase(w, t))));
+      __m256 s, c;
+      sincosAVX2(theta, &s, &c);
+
+      float qa = w->steepness * w->amplitude, ak = w->amplitude * w->k, qak = qa * w->k;
+      dx = _mm256_fmadd_ps(c, _mm256_set1_ps(qa * w->dirX), dx);
+      dz = _mm256_fmadd_ps(c, _mm256_set1_ps(qa * w->dirZ), dz);
+      dy = _mm256_fmadd_ps(s, _mm256_set1_ps(w->amplitude), dy);
+      Sxx = _mm256_fmadd_ps(s, _mm256_set1_ps(qak * w->dirX * w->dirX), Sxx);
+      Sxz = _mm256_fmadd_ps(s, _mm256_set1_ps(qak * w->dirX * w->dirZ), Sxz);
+      Szz = _mm256_fmadd_ps(s, _mm256_set1_ps(qak * w->dirZ * w->dirZ), Szz);
+      Cx = _mm256_fmadd_ps(c, _mm256_set1_ps(ak * w->dirX), Cx);
+      Cz = _mm256_fmadd_ps(c, _mm256_set1_ps(ak * w->dirZ), Cz);
+    }
+
+    __m256 ux = _mm256_sub_ps(one, Sxx), uz = _mm256_sub_ps(one, Szz);
+    _mm256_storeu_ps(px + i, _mm256_add_ps(X, dx));
+    _mm256_storeu_ps(py + i, dy);
+    _mm256_storeu_ps(pz + i, _mm256_add_ps(Z, dz));
+    _mm256_storeu_ps(nx + i, _mm256_fnmsub_ps(Sxz, Cz, _mm256_mul_ps(uz, Cx)));
+    _mm256_storeu_ps(ny + i, _mm256_fnmadd_ps(Sxz, Sxz, _mm256_mul_ps(ux, uz)));
+    _mm256_storeu_ps(nz + i, _mm256_fnmsub_ps(Sxz, Cx, _mm256_mul_ps(ux, Cz)));
+  }
+
+  spectrumScalar(spectrum, t, n - i, x + i, z + i, px + i, py + i, pz + i, nx + i, ny + i, nz + i);
+}
+#endif
+
+static SpectrumKernel kernel;
+static const char* kernelName;
+
+static void selectKernel(void)
+{
+  kernel = spectrumScalar;
+  kernelName = "scalar";
+#ifdef SPECTRUM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    kernel = spectrumAVX2;
+    kernelName = "avx2";
+  }
+  else if (__builtin_cpu_supports("sse2")) {
+    kernel = spectrumSSE;
+    kernelName = "sse";
+  }
+#endif
+}
+
+void evaluateSpectrumSoA(const WaveSpectrum* spectrum, float t, int n,
+  const float* x, const float* z,
+  float* px, float* py, float* pz,
+  float* nx, float* ny, float* nz)
+{
+  if (!kernel)
+    selectKernel();
+  kernel(spectrum, t, n, x, z, px, py, pz, nx, ny, nz);
+}
+
+void spectrumBounds(const WaveSpectrum* spectrum, float* amplitude, float* reach,
+  float* curvature, float* curvatureRate)
+{
+  int i;
+
+  *amplitude = *reach = *curvature = *curvatureRate = 0.0f;
+  for (i = 0; i < spectrum->count; i++) {
+    const GerstnerWave* w = &spectrum->waves[i];
+    *amplitude += w->amplitude;
+    *reach += w->steepness * w->amplitude;
+    *curvature += w->amplitude * w->k * w->k;
+    *curvatureRate += w->amplitude * w->k * w->k * w->k;
+  }
+}
+
+const char* spectrumPath(void)
+{
+  if (!kernel)
+    selectKernel();
+  return kernelName;
+}
@@ -0,0 +1,56 @@
+/*
+A spectrum of directional Gerstner waves, the wave of dimension 4.
+
+use makeSpectrum() to fill a spectrum with count waves (up to
+SPECTRUM_MAX_WAVES), from wavelength down to an eighth of it, spread around
+the x axis, as high on average (root sum of squares of the amplitudes) as a
+sine of amplitude
+use evaluateSpectrumSoA() for the positions and (unnormalized) normals of n
+grid points at time t, given and returned as structure of arrays, the same
+calculation as spectrumVertex() in the shaders
+use spectrumBounds() for how far the surface can be from the grid (the
+amplitude up and down, the reach sideways) and bounds of its curvature and
+of the curvature's rate of change
+The SSE/AVX2 kernel is picked at runtime, spectrumPath() names it.
+*/
+
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#if __cplusplus
+extern "C" {
+#endif
+
+
+#define SPECTRUM_MAX_WAVES 64
+
+typedef struct {
+  float dirX, dirZ;   /* unit direction of travel */
+  float k;            /* wavenumber, 2 pi / wavelength */
+  float amplitude;
+  float speed;        /* angular frequency, the phase being k dir.(x, z) + speed t + phase */
+  float phase;
+  float steepness;    /* Q, 0 for a sine, the crests sharpening as sum(Q k A) nears 1 */
+} GerstnerWave;
+
+typedef struct {
+  int count;
+  GerstnerWave waves[SPECTRUM_MAX_WAVES];
+} WaveSpectrum;
+
+void makeSpectrum(WaveSpectrum* spectrum, int count, float amplitude, float wavelength);
+void evaluateSpectrumSoA(const WaveSpectrum* spectrum, float t, int n,
+  const float* x, const float* z,
+  float* px, float* py, float* pz,
+  float* nx, float* ny, float* nz);
+void spectrumBounds(const WaveSpectrum* spectrum, float* amplitude, float* reach,
+  float* curvature, float* curvatureRate);
+const char* spectrumPath(void);
+
+
+#if __cplusplus
+}
+#endif
+
+
+#endif
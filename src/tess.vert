@@ -0,0 +1,17 @@
+//tess.vert
+#version 400 compatibility
+
+out vec3 vertColor;
+
+// Corner of a patch of the coarse grid tess.tesc subdivides (see
+// drawTessPatches()), gl_VertexID counting the 4 corners of each patch
+void main(void)
+{
+  int quad = gl_VertexID / 4, corner = gl_VertexID % 4;
+  int row = quad / uTesselation + (corner >> 1);
+  int column = quad % uTesselation + ((corner ^ (corner >> 1)) & 1);
+  float stepSize = 2.0 / float(uTesselation);
+
+  gl_Position = vec4(-1.0 + float(column) * stepSize, 0.0, -1.0 + float(row) * stepSize, 1.0);
+  vertColor = vec3(gl_Color);
+}
@@ -0,0 +1,137 @@
+/* Persistent worker pool, see workers.h */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "workers.h"
+
+namespace {
+
+struct Pool {
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable start, done;
+
+  // Current job, published to the workers by bumping generation
+  WorkerFunc fn;
+  void* data;
+  int n, bandSize, bands;
+  std::atomic<int> next;
+  int busy;
+  unsigned generation;
+  bool stop;
+
+  Pool() : fn(NULL), data(NULL), n(0), bandSize(0), bands(0), next(0),
+    busy(0), generation(0), stop(false) {}
+  ~Pool() { resize(0); }
+
+  void runBands()
+  {
+    int band;
+    while ((band = next++) < bands) {
+      int begin = band * bandSize;
+      fn(begin, std::min(n, begin + bandSize), data);
+    }
+  }
+
+  // seen is the generation when the thread started, so it only runs jobs
+  // published after that
+  void work(unsigned seen)
+  {
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        start.wait(lock, [&] { return stop || generation != seen; });
+        if (stop)
+          return;
+        seen = generation;
+      }
+      runBands();
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--busy == 0)
+        done.notify_one();
+    }
+  }
+
+  // Number of extra threads, the caller of parallelFor() is the last one
+  void resize(int count)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    start.notify_all();
+    for (size_t i = 0; i < threads.size(); i++)
+      threads[i].join();
+    threads.clear();
+
+    stop = false;
+    for (int i = 0; i < count; i++)
+      threads.push_back(std::thread(&Pool::work, this, generation));
+  }
+};
+
+Pool pool;
+int requested = 0;
+bool started = false;
+
+int defaultThreads()
+{
+  int cores = std::thread::hardware_concurrency();
+  return cores > 0 ? cores : 1;
+}
+
+}
+
+void setWorkerThreads(int threads)
+{
+  requested = threads;
+  pool.resize((threads > 0 ? threads : defaultThreads()) - 1);
+  started = true;
+}
+
+int workerThreads()
+{
+  if (!started)
+    setWorkerThreads(requested);
+  return pool.threads.size() + 1;
+}
+
+void parallelFor(int n, int grain, WorkerFunc fn, void* data)
+{
+  int threads = workerThreads();
+  if (grain < 1)
+    grain = 1;
+
+  // Not worth waking the pool up for, run on the calling thread
+  if (threads == 1 || n <= grain) {
+    if (n > 0)
+      fn(0, n, data);
+    return;
+  }
+
+  // Several bands per thread so uneven bands still balance out
+  int bands = std::min(threads * 4, (n + grain - 1) / grain);
+
+  {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.fn = fn;
+    pool.data = data;
+    pool.n = n;
+    pool.bandSize = (n + bands - 1) / bands;
+    pool.bands = (n + pool.bandSize - 1) / pool.bandSize;
+    pool.next = 0;
+    pool.busy = pool.threads.size();
+    pool.generation++;
+  }
+  pool.start.notify_all();
+
+  pool.runBands();
+
+  std::unique_lock<std::mutex> lock(pool.mutex);
+  pool.done.wait(lock, [] { return pool.busy == 0; });
+}
@@ -0,0 +1,21 @@
+/*
+Persistent pool of worker threads used to split loops such as mesh rows.
+
+use parallelFor() to run fn(begin, end, data) over [0, n) in contiguous
+bands of at least grain items, the calling thread takes bands too and it
+returns once all of them have finished
+use setWorkerThreads() to choose the number of threads (0 = one per core)
+*/
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+
+typedef void (*WorkerFunc)(int begin, int end, void* data);
+
+void parallelFor(int n, int grain, WorkerFunc fn, void* data);
+void setWorkerThreads(int threads);
+int workerThreads();
+
+
+#endif